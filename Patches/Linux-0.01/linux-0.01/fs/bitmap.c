@@ -106,7 +106,7 @@ void free_block(int dev, int block)
 		printk("block (%04x:%d) ",dev,block+sb->s_firstdatazone-1);
 		panic("free_block: bit already cleared");
 	}
-	sb->s_zmap[block/8192]->b_dirt = 1;
+	mark_buffer_dirty(sb->s_zmap[block/8192]);
 }
 
 /*XXX:XXX
@@ -133,7 +133,7 @@ int new_block(int dev)
   // XXX:XXX ????? how - struct buffer_head * s_imap[8];
 	if (set_bit(j,bh->b_data))
 		panic("new_block: bit already set");
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	j += i*8192 + sb->s_firstdatazone-1;
 	if (j >= sb->s_nzones)
 		return 0;
@@ -145,7 +145,7 @@ int new_block(int dev)
   // update in memory structure
 	clear_block(bh->b_data);
 	bh->b_uptodate = 1;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	brelse(bh);
 	return j;
 }
@@ -182,7 +182,7 @@ void free_inode(struct m_inode * inode)
 		panic("nonexistent imap in superblock");
 	if (clear_bit(inode->i_num&8191,bh->b_data))
 		panic("free_inode: bit already cleared");
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
   // clean in memory structure
 	memset(inode,0,sizeof(*inode));
 }
@@ -220,7 +220,7 @@ struct m_inode * new_inode(int dev)
 	if (set_bit(j,bh->b_data))
 		panic("new_inode: bit already set");
   // update the in memory structure
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	inode->i_count=1;
 	inode->i_nlinks=1;
 	inode->i_dev=dev;
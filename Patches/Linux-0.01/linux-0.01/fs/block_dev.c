@@ -2,10 +2,16 @@
  * DONE:  read/write from block dev.
  */
 #include <errno.h>
+#include <string.h>
 
-#include <linux/fs.h>
+#include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
+#include <asm/system.h>
 #include <asm/segment.h>
+#include <linux/hdreg.h>
+#include <linux/md.h>
+#include <sys/iostat.h>
 
 #define NR_BLK_DEV ((sizeof (rd_blk))/(sizeof (rd_blk[0])))
 
@@ -41,7 +47,7 @@ int block_write(int dev, long * pos, char * buf, int count)
 		count -= chars;
 		while (chars-->0)
 			*(p++) = get_fs_byte(buf++);
-		bh->b_dirt = 1; 
+		mark_buffer_dirty(bh); 
 		brelse(bh); // XXX:XXX ?????  brelese do not cpy the in memory data to the disk/dev 
                 //         shoud we call dev_sync(), to write back into dev
                 //         who take care of writting back
@@ -56,23 +62,30 @@ int block_write(int dev, long * pos, char * buf, int count)
  * XXX:XXX
  *     read block from device
  *     dev   : device number
- *     *pos  : offsect within whole device
+ *     filp  : the open device, filp->f_pos is the
+ *             offsect within whole device
  *     *buf  : in memory buffer where data has to be copied
  *     count : no of the bytes has to be read
+ *
+ *     Sequential reads get the blocks after
+ *     them read ahead, see readahead().
  */
-int block_read(int dev, unsigned long * pos, char * buf, int count)
+int block_read(int dev, struct file * filp, char * buf, int count)
 {
+	unsigned long * pos = (unsigned long *) &filp->f_pos;
 	int block = *pos / BLOCK_SIZE;
 	int offset = *pos % BLOCK_SIZE;
 	int chars;
 	int read = 0;
+	int ahead[NR_AHEAD];
 	struct buffer_head * bh;
 	register char * p;
 
 	while (count>0) {
-		bh = bread(dev,block);
+		bh = breada(dev,block,ahead,readahead(filp,block,ahead));
 		if (!bh)
 			return read?read:-EIO;
+		readahead_done(filp,bh);
 		chars = (count<BLOCK_SIZE) ? count : BLOCK_SIZE;
 		p = offset + bh->b_data;
 		offset = 0;
@@ -82,7 +95,6 @@ int block_read(int dev, unsigned long * pos, char * buf, int count)
 		count -= chars;
 		while (chars-->0)
 			put_fs_byte(*(p++),buf++);
-		bh->b_dirt = 1;
 		brelse(bh); // XXX:XXX ?????  brelese do not cpy the in memory data to the disk/dev 
                 //         who take care of writting back
                 //         what does dirty mean here
@@ -92,7 +104,234 @@ int block_read(int dev, unsigned long * pos, char * buf, int count)
 	return read;
 }
 
+/*
+ * block_direct() is read and write for block devices opened O_DIRECT:
+ * the blocks go straight between the device and the user's memory,
+ * without a copy and without taking up the buffer cache. The position,
+ * the count and the user's buffer must all be multiples of BLOCK_SIZE,
+ * so a block never straddles two pages. NR_DIRECT blocks at a time are
+ * handed over under one plug, so the driver makes requests of many
+ * sectors out of them.
+ */
+#define NR_DIRECT	32
+
+extern void write_verify(unsigned long address);
+
+/*
+ * user_block() gives the physical address of the user's block at
+ * 'addr', faulting the page in first. For a read into it the page is
+ * also unshared, as the device writes it behind the paging's back.
+ */
+static char * user_block(char * addr, int rw)
+{
+	unsigned long lin = (unsigned long) addr + get_base(current->ldt[2]);
+	unsigned long * table;
+
+	get_fs_byte(addr);
+	if (rw != WRITE)
+		write_verify(lin);
+	table = (unsigned long *) (0xfffff000 &
+		*(unsigned long *) ((lin>>20) & 0xffc));
+	return (char *) ((0xfffff000 & table[(lin>>12) & 0x3ff]) +
+		(lin & 0xfff));
+}
+
+/*
+ * direct_cached() keeps a block the cache happens to hold in step with
+ * direct I/O on it. Before the I/O (data == NULL) a dirty copy is
+ * written out, so a direct read sees it and it can't overwrite a direct
+ * write later. After a direct write the copy gets the new data.
+ */
+static void direct_cached(int dev, int block, char * data)
+{
+	struct buffer_head * bh;
+
+	if (!(bh = get_hash_table(dev,block)))
+		return;
+	if (!data) {
+		if (bh->b_dirt) {
+			ll_rw_block(WRITE,bh);
+			wait_on_buffer(bh);
+		}
+	} else if (bh->b_uptodate)
+		memcpy(bh->b_data,data,BLOCK_SIZE);
+	brelse(bh);
+}
+
+int block_direct(int rw, int dev, off_t * pos, char * buf, int count)
+{
+	struct buffer_head * dbh, * bh;
+	int block = *pos / BLOCK_SIZE;
+	int done = 0;
+	int i, n;
+
+	if ((*pos | count | (unsigned long) buf) & (BLOCK_SIZE-1))
+		return -EINVAL;
+	if (count <= 0)
+		return 0;
+	if (!(dbh = (struct buffer_head *) get_free_page()))
+		return -ENOMEM;
+	while (count > 0) {
+		n = count / BLOCK_SIZE;
+		if (n > NR_DIRECT)
+			n = NR_DIRECT;
+		for (i = 0 ; i < n ; i++)
+			direct_cached(dev,block+i,NULL);
+		plug_blocks();
+		for (i = 0 ; i < n ; i++) {
+			bh = dbh+i;
+			bh->b_data = user_block(buf+i*BLOCK_SIZE,rw);
+			bh->b_dev = dev;
+			bh->b_blocknr = block+i;
+			bh->b_uptodate = 0;
+			bh->b_count = 1;	/* only ever on the locked list */
+			bh->b_list = NR_LIST;
+			ll_rw_block(rw,bh);
+		}
+		unplug_blocks();
+		for (i = 0 ; i < n ; i++)
+			wait_on_buffer(dbh+i);
+		for (i = 0 ; i < n && dbh[i].b_uptodate ; i++)
+			if (rw == WRITE)
+				direct_cached(dev,block+i,dbh[i].b_data);
+		done += i*BLOCK_SIZE;
+		*pos += i*BLOCK_SIZE;
+		if (i < n)
+			break;
+		block += n;
+		buf += n*BLOCK_SIZE;
+		count -= n*BLOCK_SIZE;
+	}
+	free_page((unsigned long) dbh);
+	return done ? done : -EIO;
+}
+
+/*
+ * The I/O statistics, by device. ll_rw_block() counts a block as in
+ * flight when it gives it to the driver, and the driver calls
+ * iostat_done() when it is finished, with the time it started it.
+ * Drivers that join blocks into one request count the joined ones in
+ * 'merges'.
+ */
+static struct iostat iostat_table[NR_IOSTAT];
+static struct iostat iostat_other;	/* when the table is full */
+
+static void iostat_tick(struct iostat * st)
+{
+	unsigned long t = jiffies - st->stamp;
+
+	if (st->in_flight) {
+		st->busy_ticks += t;
+		st->weighted_ticks += t * st->in_flight;
+	}
+	st->stamp = jiffies;
+}
+
+struct iostat * find_iostat(int dev)
+{
+	struct iostat * st, * empty = NULL;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	for (st = iostat_table ; st < iostat_table+NR_IOSTAT ; st++)
+		if (st->dev == dev) {
+			restore_flags(flags);
+			return st;
+		} else if (!st->dev && !empty)
+			empty = st;
+	if (empty) {
+		empty->dev = dev;
+		empty->stamp = jiffies;
+	} else
+		empty = &iostat_other;
+	restore_flags(flags);
+	return empty;
+}
+
+/*
+ * iostat_done() is called by the driver (usually from its interrupt)
+ * before it unlocks a finished buffer, so it leaves the interrupt flag
+ * as it found it. dir is 0 for reads, 1 for
+ * writes, and 'issued' when the device was given the block.
+ */
+void iostat_done(struct buffer_head * bh, int dir, long issued)
+{
+	struct iostat * st;
+	unsigned long flags;
+
+	if (!bh->b_acct)
+		return;
+	st = find_iostat(bh->b_dev);
+	save_flags(flags);
+	cli();
+	iostat_tick(st);
+	st->in_flight--;
+	st->ios[dir]++;
+	st->sectors[dir] += BLOCK_SIZE/512;
+	st->queue_ticks[dir] += issued - bh->b_start;
+	st->svc_ticks[dir] += jiffies - issued;
+	bh->b_acct = 0;
+	restore_flags(flags);
+}
+
+static int put_stat(void * stat, int size, char * buf)
+{
+	unsigned long * p = (unsigned long *) stat;
+	int i;
+
+	verify_area(buf,size);
+	for (i = 0 ; i < size/sizeof (long) ; i++)
+		put_fs_long(p[i],i+(unsigned long *) buf);
+	return 0;
+}
+
+/*
+ * sys_iostat() copies the statistics of up to n devices to 'buf', and
+ * returns how many there were. A negative n asks for those of a driver,
+ * see <sys/iostat.h>.
+ */
+int sys_iostat(struct iostat * buf, int n)
+{
+	struct iostat * st;
+	unsigned long * p;
+	int i,nr = 0;
+
+	switch (n) {
+		case IOSTAT_HD:
+			return put_stat(&hd_stat,sizeof (struct hd_stat),
+				(char *) buf);
+		case IOSTAT_MD:
+			return put_stat(&md_stat,sizeof (struct md_stat),
+				(char *) buf);
+		case IOSTAT_MEM:
+			return put_stat(&page_stat,sizeof (struct page_stat),
+				(char *) buf);
+	}
+	if (n < 0)
+		return -EINVAL;
+	for (st = iostat_table ; st < iostat_table+NR_IOSTAT && nr < n ; st++) {
+		if (!st->dev)
+			continue;
+		verify_area(buf,sizeof (struct iostat));
+		cli();
+		iostat_tick(st);
+		sti();
+		p = (unsigned long *) st;
+		for (i = 0 ; i < sizeof (struct iostat)/sizeof (long) ; i++)
+			put_fs_long(p[i],i+(unsigned long *) buf);
+		buf++;
+		nr++;
+	}
+	return nr;
+}
+
+extern void rw_ram(int rw, struct buffer_head * bh);
 extern void rw_hd(int rw, struct buffer_head * bh);
+extern void rw_vd(int rw, struct buffer_head * bh);
+extern void rw_md(int rw, struct buffer_head * bh);
+extern void unplug_hd(void);
+extern void unplug_vd(void);
 
 typedef void (*blk_fn)(int rw, struct buffer_head * bh);
 
@@ -104,26 +343,140 @@ typedef void (*blk_fn)(int rw, struct buffer_head * bh);
  */
 static blk_fn rd_blk[]={
 	NULL,		/* nodev */
-	NULL,		/* dev mem */
+	rw_ram,		/* dev mem (ram disk) */
 	NULL,		/* dev fd */
 	rw_hd,		/* dev hd */
 	NULL,		/* dev ttyx */
 	NULL,		/* dev tty */
-	NULL};		/* dev lp */
+	NULL,		/* dev lp */
+	NULL,		/* pipes */
+	rw_vd,		/* dev vd */
+	rw_md};		/* dev md */
+
+/*
+ * Plugging. A burst of blocks - a sync, a cluster of writes, a multi-
+ * block read - is handed to the drivers between plug_blocks() and
+ * unplug_blocks(). Meanwhile the drivers with request queues only queue
+ * them, so the first block isn't started on its own before the rest are
+ * there to be sorted and merged with it. unplug_blocks() starts them.
+ * So does the timer, PLUG_TICKS after the plug, in case the submitter
+ * has to sleep with the plug in: the plug is then let go for everybody
+ * until the last submitter has unplugged.
+ */
+#define PLUG_TICKS	2
+
+static void (*unplug_blk[])(void)={
+	NULL,		/* nodev */
+	NULL,		/* dev mem: no queue */
+	NULL,		/* dev fd */
+	unplug_hd,	/* dev hd */
+	NULL,		/* dev ttyx */
+	NULL,		/* dev tty */
+	NULL,		/* dev lp */
+	NULL,		/* pipes */
+	unplug_vd,	/* dev vd */
+	NULL};		/* dev md: its members are */
+
+static int plug_depth = 0;
+static long plug_expires = 0;
+static int plug_timer = 0;
+
+static void run_queues(void)
+{
+	int i;
+
+	for (i = 0 ; i < NR_BLK_DEV ; i++)
+		if (unplug_blk[i])
+			unplug_blk[i]();
+}
+
+/*
+ * plug_timeout() runs from the timer, with interrupts off: the unplug
+ * functions of the drivers must leave them that way.
+ */
+static void plug_timeout(void)
+{
+	plug_timer = 0;
+	if (blocks_plugged()) {		/* a later plug, not ours */
+		plug_timer = 1;
+		add_timer(plug_expires - jiffies,&plug_timeout);
+		return;
+	}
+	run_queues();
+}
+
+void plug_blocks(void)
+{
+	cli();
+	if (!plug_depth++) {
+		plug_expires = jiffies + PLUG_TICKS;
+		if (!plug_timer) {
+			plug_timer = 1;
+			add_timer(PLUG_TICKS,&plug_timeout);
+		}
+	}
+	sti();
+}
+
+void unplug_blocks(void)
+{
+	if (!plug_depth)
+		panic("unplug_blocks: not plugged");
+	if (!--plug_depth)
+		run_queues();
+}
+
+/*
+ * blocks_plugged() tells a driver not to start the request it has just
+ * queued. It doesn't matter for requests it starts from its interrupt.
+ */
+int blocks_plugged(void)
+{
+	return plug_depth && (long) (jiffies - plug_expires) < 0;
+}
 
 /*
  * XXX:XXX
  *     block function to read write
  *     Why here and why not use block_read, block_write
  *     What these do??
+ *
+ * ll_rw_block() only starts the I/O: the buffer stays locked until it is
+ * done, and the caller has to wait_on_buffer() before looking at
+ * b_uptodate. If b_end_io is set, it is called (from the interrupt, with
+ * b_end_io cleared again) when the buffer is done - or at once, if the
+ * driver didn't take the request, like a dropped READA or a block past
+ * the end of the device.
  */
-*     
 void ll_rw_block(int rw, struct buffer_head * bh)
 {
 	blk_fn blk_addr;
 	unsigned int major;
+	void (*end_io)(struct buffer_head *);
+	struct iostat * st;
 
 	if ((major=MAJOR(bh->b_dev)) >= NR_BLK_DEV || !(blk_addr=rd_blk[major]))
 		panic("Trying to read nonexistent block-device");
+	st = find_iostat(bh->b_dev);
+	cli();
+	iostat_tick(st);
+	st->in_flight++;
+	bh->b_acct = 1;
+	bh->b_start = jiffies;
+	sti();
 	blk_addr(rw, bh);
+	if (!bh->b_lock && bh->b_acct) {	/* not taken */
+		cli();
+		iostat_tick(st);
+		st->in_flight--;
+		bh->b_acct = 0;
+		sti();
+	}
+	if (bh->b_lock)
+		return;
+	refile_buffer(bh);	/* done at once (ram disk), or not taken */
+	if ((end_io = bh->b_end_io)) {
+		bh->b_end_io = NULL;
+		end_io(bh);
+	}
 }
@@ -9,7 +9,10 @@
 #include <linux/config.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <asm/system.h>
+#include <asm/segment.h>
+#include <errno.h>
 
 /*
  * BUFFER SIZE = BLOCK SIZE
@@ -25,14 +28,65 @@
 
 extern int end;
 struct buffer_head * start_buffer = (struct buffer_head *) &end;
-struct buffer_head * hash_table[NR_HASH]; // buffer list, using hash of (device, block)
-static struct buffer_head * free_list; // free list of buffers aviable.
+static struct buffer_head * boot_hash[NR_HASH];
+static struct buffer_head ** hash_table = boot_hash; // buffer list, using hash of (device, block)
+static int nr_hash = NR_HASH;
+static struct buffer_head * unused_list = NULL;	/* heads without a buffer */
+static int nr_unused = 0;
+static struct buffer_head * lru_list[NR_LIST] = {NULL,}; // clean/locked/dirty lists, oldest first
 static struct task_struct * buffer_wait = NULL;
 int NR_BUFFERS = 0;
+int nr_buffers_type[NR_LIST] = {0,};
+struct buffer_stat buffer_stat = {0,};
+
+/* max nr of blocks written by getblk() to free one dirty buffer */
+#define NR_CLUSTER 8
+
+/*
+ * The tunables of the writeback daemon, see sys_bdflush().
+ */
+#define NR_BATCH 64
+
+static union bdflush_param {
+	struct {
+		long interval;		/* ticks between two runs */
+		long age_buffer;	/* ticks a buffer may stay dirty */
+		long nfract;		/* % of dirty buffers that wakes us early */
+		long ndirty;		/* max blocks written in one batch */
+		long nap;		/* ticks to rest between two batches */
+		long ra_min;		/* smallest read-ahead window */
+		long ra_max;		/* largest read-ahead window */
+		long policy;		/* replacement: 0 - plain LRU, 1 - 2Q */
+		long kin;		/* % of buffers the BUF_NEW list may hold */
+		long grow_free;		/* free pages needed to grow the cache */
+		long shrink_free;	/* shrink it when there are fewer */
+	} b_un;
+	long data[NR_BDF_PARAM];
+} bdf_prm = {{5*HZ, 30*HZ, 60, 32, 1, 2, 16, 1, 25, 128, 64}};
+
+static long bdflush_min[NR_BDF_PARAM] = {HZ, 0, 1, 1, 0, 1, 1, 0, 1, 0, 0};
+static long bdflush_max[NR_BDF_PARAM] = {600*HZ, 600*HZ, 100, NR_BATCH, HZ,
+	NR_AHEAD, NR_AHEAD, 1, 99, 4096, 4096};
+
+static struct task_struct * bdflush_task = NULL;
+static struct task_struct * bdflush_wait = NULL;
+static int bdflush_timer = 0;
+
+#define too_many_dirty() \
+(nr_buffers_type[BUF_DIRTY]*100 > bdf_prm.b_un.nfract*NR_BUFFERS)
+
+/*
+ * The ghost table of the 2Q policy: the (dev,block) of buffers thrown out
+ * of the BUF_NEW list, direct-mapped by their hash. See get_free_buffer().
+ * Its size stays fixed when the hash table is resized.
+ */
+#define GHOST(dev,block) ((((unsigned long)(dev))<<16)|(block))
+#define _ghostfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
+static unsigned long ghost[NR_HASH];
 
 
 // locking
-static inline void wait_on_buffer(struct buffer_head * bh)
+void wait_on_buffer(struct buffer_head * bh)
 {
 	cli();
 	while (bh->b_lock)
@@ -40,101 +94,220 @@ static inline void wait_on_buffer(struct buffer_head * bh)
 	sti();
 }
 
+/*
+ * The lru-lists. Every buffer that is locked, dirty, or clean and
+ * unused is on exactly one of the lists, oldest buffer first. Clean
+ * buffers are on BUF_CLEAN, or on BUF_NEW if the 2Q policy is on and
+ * they haven't proved they are worth keeping yet (see b_hot). Buffers
+ * that hold no block at all are on BUF_FREE. A buffer
+ * that is in use but neither dirty nor locked is on no list at all
+ * (b_list == NR_LIST), so the head of the clean list is always the
+ * least recently used buffer that getblk() may take, and sync only ever
+ * looks at the dirty list.
+ *
+ * The hd-interrupt moves buffers off the locked list when their I/O is
+ * done, so the list manipulation has to happen with interrupts off.
+ */
+static inline void remove_from_lru(struct buffer_head * bh)
+{
+	if (bh->b_list >= NR_LIST)
+		return;
+	if (!(bh->b_prev_free) || !(bh->b_next_free))
+		panic("Free block list corrupted");
+	if (bh->b_next_free == bh)
+		lru_list[bh->b_list] = NULL;
+	else {
+		bh->b_prev_free->b_next_free = bh->b_next_free;
+		bh->b_next_free->b_prev_free = bh->b_prev_free;
+		if (lru_list[bh->b_list] == bh) // If its the first
+			lru_list[bh->b_list] = bh->b_next_free;
+	}
+	nr_buffers_type[bh->b_list]--;
+	bh->b_prev_free = bh->b_next_free = NULL;
+	bh->b_list = NR_LIST;
+}
 
-// write back dirty ( inodes + buffer )
-// into the disk/dev
-// NOTE: inodes are in inode_table
-int sys_sync(void)
+/* put at end of the list, ie make it the most recently used */
+static inline void append_to_lru(struct buffer_head * bh, int list)
 {
-	int i;
-	struct buffer_head * bh;
+	struct buffer_head * head = lru_list[list];
 
-	sync_inodes();		/* write out inodes into buffers */
-	bh = start_buffer;
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		wait_on_buffer(bh);
-		if (bh->b_dirt)
-			ll_rw_block(WRITE,bh);
+	if (!head) {
+		lru_list[list] = bh;
+		bh->b_prev_free = bh->b_next_free = bh;
+	} else {
+		bh->b_next_free = head;
+		bh->b_prev_free = head->b_prev_free;
+		head->b_prev_free->b_next_free = bh;
+		head->b_prev_free = bh;
 	}
-	return 0;
+	bh->b_list = list;
+	nr_buffers_type[list]++;
 }
 
-// write back the dirty blocks
-// of dev/disk
-static int sync_dev(int dev)
+/*
+ * refile_buffer() puts a buffer on the list its state says it should
+ * be on. It has to be called every time b_count drops to zero, and
+ * every time b_lock or b_dirt changes - brelse(), mark_buffer_dirty()
+ * and the lock-functions in hd.c do that. A buffer that already is on
+ * the right list keeps its place, so the dirty list stays sorted by
+ * the time the buffers were dirtied.
+ */
+void refile_buffer(struct buffer_head * bh)
+{
+	unsigned long flags;
+	int list;
+
+	save_flags(flags);
+	cli();
+	if (bh->b_lock)
+		list = BUF_LOCKED;
+	else if (bh->b_dirt)
+		list = BUF_DIRTY;
+	else if (bh->b_count)
+		list = NR_LIST;
+	else if (!bh->b_dev)
+		list = BUF_FREE;
+	else
+		list = (bdf_prm.b_un.policy && !bh->b_hot) ? BUF_NEW : BUF_CLEAN;
+	if (bh->b_list != list) {
+		remove_from_lru(bh);
+		if (list < NR_LIST)
+			append_to_lru(bh,list);
+	}
+	restore_flags(flags);
+	if (list == BUF_CLEAN || list == BUF_NEW || list == BUF_FREE)
+		wake_up(&buffer_wait);
+}
+
+/*
+ * b_dirtime is set when a clean buffer gets dirty, so the writeback
+ * daemon can tell how long it has been waiting. Too many dirty buffers
+ * wake the daemon up before its time.
+ */
+void mark_buffer_dirty(struct buffer_head * bh)
+{
+	if (!bh->b_dirt)
+		bh->b_dirtime = jiffies;
+	bh->b_dirt = 1;
+	if (bh->b_list != BUF_DIRTY)
+		refile_buffer(bh);
+	if (too_many_dirty() && bdflush_wait) {
+		buffer_stat.flush_early++;
+		wake_up(&bdflush_wait);
+	}
+}
+
+/*
+ * like brelse(), but doesn't wait for the I/O on the buffer to finish
+ */
+static inline void bforget(struct buffer_head * bh)
+{
+	if (!(bh->b_count--))
+		panic("Trying to free free buffer");
+	refile_buffer(bh);
+}
+
+/*
+ * write back the dirty blocks of dev/disk (all devices if dev==0).
+ * Only the dirty list is looked at. A buffer leaves the list as soon as
+ * its write is queued, so we start over from the head after every one -
+ * but never write more blocks than were dirty to begin with, or a block
+ * that keeps failing would have us loop forever.
+ *
+ * All the writes are queued first, so the driver can sort them, and we
+ * sleep just once, until sync_end_io() has seen the last of them done.
+ */
+static int sync_pending = 0;
+static struct task_struct * sync_wait = NULL;
+
+static void sync_end_io(struct buffer_head * bh)
+{
+	if (!--sync_pending)
+		wake_up(&sync_wait);
+}
+
+static void sync_buffers(int dev)
 {
-	int i;
 	struct buffer_head * bh;
+	int i, nr;
 
-	bh = start_buffer;
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		if (bh->b_dev != dev)
+	nr = nr_buffers_type[BUF_DIRTY];
+	plug_blocks();
+repeat:
+	bh = lru_list[BUF_DIRTY];
+	for (i = nr_buffers_type[BUF_DIRTY] ; nr > 0 && i-- > 0 ;
+	    bh = bh->b_next_free) {
+		if (dev && bh->b_dev != dev)
 			continue;
-		wait_on_buffer(bh);
-		if (bh->b_dirt)
-			ll_rw_block(WRITE,bh);
+		if (!bh->b_dirt) {
+			refile_buffer(bh);
+			goto repeat;
+		}
+		nr--;
+		cli();
+		sync_pending++;
+		sti();
+		bh->b_end_io = sync_end_io;
+		ll_rw_block(WRITE,bh);
+		if (bh->b_list == BUF_DIRTY) {	/* not taken: don't retry it */
+			cli();
+			remove_from_lru(bh);
+			append_to_lru(bh,BUF_DIRTY);
+			sti();
+		}
+		goto repeat;
 	}
+	unplug_blocks();
+	cli();
+	while (sync_pending)
+		sleep_on(&sync_wait);
+	sti();
+}
+
+// write back dirty ( inodes + buffer )
+// into the disk/dev
+// NOTE: inodes are in inode_table
+int sys_sync(void)
+{
+	sync_inodes();		/* write out inodes into buffers */
+	sync_buffers(0);
 	return 0;
 }
 
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
+#define _hashfn(dev,block) (((unsigned)(dev^block))%nr_hash)
 #define hash(dev,block) hash_table[_hashfn(dev,block)]
 
 
 /*
  * remove the in memory buffer from
- * hash queue & free list
+ * hash queue
  */
-static inline void remove_from_queues(struct buffer_head * bh)
+static inline void remove_from_hash(struct buffer_head * bh)
 {
-/*
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
-#define hash(dev,block) hash_table[_hashfn(dev,block)]
-*/
-
-/* remove from hash-queue */
 	if (bh->b_next)
 		bh->b_next->b_prev = bh->b_prev;
 	if (bh->b_prev)
 		bh->b_prev->b_next = bh->b_next;
 	if (hash(bh->b_dev,bh->b_blocknr) == bh) // If its the head
 		hash(bh->b_dev,bh->b_blocknr) = bh->b_next;
-/* remove from free list */
-	if (!(bh->b_prev_free) || !(bh->b_next_free))
-		panic("Free block list corrupted");
-	bh->b_prev_free->b_next_free = bh->b_next_free;
-	bh->b_next_free->b_prev_free = bh->b_prev_free;
-	if (free_list == bh) // If its the first
-		free_list = bh->b_next_free;
+	bh->b_prev = NULL;
+	bh->b_next = NULL;
 }
 
-
-
-
 /*
- * insert a buffer into in memory 
- * free buffers + hash queue if ( have div + block )
+ * put the buffer in new hash-queue if it has a device
  */
-static inline void insert_into_queues(struct buffer_head * bh)
+static inline void insert_into_hash(struct buffer_head * bh)
 {
-/*
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
-#define hash(dev,block) hash_table[_hashfn(dev,block)]
-*/
-
-/* put at end of free list */
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
-/* put the buffer in new hash-queue if it has a device */
 	bh->b_prev = NULL;
 	bh->b_next = NULL;
 	if (!bh->b_dev)
 		return;
 	bh->b_next = hash(bh->b_dev,bh->b_blocknr);
 	hash(bh->b_dev,bh->b_blocknr) = bh;
-	bh->b_next->b_prev = bh;
+	if (bh->b_next)
+		bh->b_next->b_prev = bh;
 }
 
 
@@ -175,6 +348,7 @@ repeat:
 	if (!(bh=find_buffer(dev,block)))
 		return NULL;
 	bh->b_count++;
+	refile_buffer(bh);	/* it isn't free any more */
 	wait_on_buffer(bh);
 	if (bh->b_dev != dev || bh->b_blocknr != block) {
 		brelse(bh);
@@ -184,6 +358,288 @@ repeat:
 }
 
 
+/*
+ * get_free_buffer() is the replacement policy: it takes a clean, unused
+ * buffer off its list, or returns NULL. Call it with interrupts off.
+ * Empty buffers, on BUF_FREE, are always taken first.
+ *
+ * Plain LRU just takes the oldest one. 2Q (the default) keeps buffers
+ * that have been read in only once on the BUF_NEW list, and takes the
+ * oldest of those as long as the list holds more than kin% of all the
+ * buffers. Their blocks go into the ghost table, and a block that is
+ * wanted again while it is still there was thrown out too early: it
+ * comes back as a hot BUF_CLEAN buffer. So a big sequential read only
+ * cycles through BUF_NEW, and inode, bitmap and directory blocks that
+ * are used over and over stay cached.
+ */
+static struct buffer_head * get_free_buffer(void)
+{
+	struct buffer_head * bh;
+
+	if (!(bh = lru_list[BUF_FREE]) &&
+	    (!(bh = lru_list[BUF_NEW]) || (lru_list[BUF_CLEAN] &&
+	    (!bdf_prm.b_un.policy ||
+	    nr_buffers_type[BUF_NEW]*100 <= bdf_prm.b_un.kin*NR_BUFFERS))))
+		bh = lru_list[BUF_CLEAN];
+	if (!bh)
+		return NULL;
+	if (bh->b_list == BUF_NEW && bh->b_dev)
+		ghost[_ghostfn(bh->b_dev,bh->b_blocknr)] =
+			GHOST(bh->b_dev,bh->b_blocknr);
+	remove_from_lru(bh);
+	bh->b_count++;
+	return bh;
+}
+
+/*
+ * A buffer getblk() can't write - the driver didn't take it, or it came
+ * back with an error - loses its dirty bit, as it did when getblk()
+ * synced the device. Else getblk() would pick it again and again.
+ */
+static void write_failed(struct buffer_head * bh)
+{
+	printk("write error: dev %04x, block %d, dropped\n\r",
+		bh->b_dev,bh->b_blocknr);
+	bh->b_dirt = 0;
+	bh->b_uptodate = 0;
+	refile_buffer(bh);
+}
+
+/*
+ * write_cluster() writes out the dirty buffer getblk() wants to reuse.
+ * Its unused dirty neighbours on the same device go along, sorted by
+ * block number, as they cost next to no extra seeking - but nothing
+ * else, so a process that needs one buffer doesn't have to wait for
+ * the whole device to be synced. The caller holds 'bh', and we wait
+ * for it only, not for the neighbours.
+ */
+static void write_cluster(struct buffer_head * bh)
+{
+	struct buffer_head * list[NR_CLUSTER], * tmp;
+	int dev = bh->b_dev, block = bh->b_blocknr;
+	int i, j, n;
+
+	list[0] = bh;
+	n = 1;
+	for (i = 1 ; i <= NR_CLUSTER/2 ; i++) {
+		if (block >= i && (tmp = find_buffer(dev,block-i)) &&
+		    tmp->b_dirt && !tmp->b_lock && !tmp->b_count)
+			list[n++] = tmp;
+		if (n < NR_CLUSTER && (tmp = find_buffer(dev,block+i)) &&
+		    tmp->b_dirt && !tmp->b_lock && !tmp->b_count)
+			list[n++] = tmp;
+		if (n >= NR_CLUSTER)
+			break;
+	}
+	for (i = 1 ; i < n ; i++) {
+		tmp = list[i];
+		tmp->b_count++;
+		for (j = i ; j > 0 && list[j-1]->b_blocknr > tmp->b_blocknr ; j--)
+			list[j] = list[j-1];
+		list[j] = tmp;
+	}
+	plug_blocks();
+	for (i = 0 ; i < n ; i++) {
+		buffer_stat.evict_writes++;
+		ll_rw_block(WRITE,list[i]);
+		if (!list[i]->b_lock && list[i]->b_dirt)
+			write_failed(list[i]);		/* not taken */
+	}
+	unplug_blocks();
+	for (i = 0 ; i < n ; i++)
+		if (list[i] != bh)
+			bforget(list[i]);
+	wait_on_buffer(bh);
+	if (bh->b_dirt && !bh->b_uptodate)
+		write_failed(bh);
+}
+
+/*
+ * The cache starts out with the buffers between the kernel and BUFFER_END
+ * that buffer_init() sets up, and grows a page (4 buffers) at a time from
+ * the page allocator whenever getblk() has no empty buffer and there are
+ * more than 'grow_free' free pages. shrink_buffers() gives the pages back
+ * when memory gets short: the writeback daemon calls it when there are
+ * fewer than 'shrink_free' free pages, and the page-fault handlers before
+ * giving up. The buffers of a page are linked by b_this_page, so a page
+ * can only go when all of them are clean and unused. The boot buffers
+ * have no page of their own (b_this_page == NULL) and always stay.
+ *
+ * The buffer heads come from pages of their own, and are kept on the
+ * unused_list when their buffer goes: they are never given back.
+ */
+static int get_more_buffer_heads(void)
+{
+	struct buffer_head * bh;
+	unsigned long page;
+	int i;
+
+	if (!(page = get_free_page()))
+		return 0;
+	bh = (struct buffer_head *) page;
+	for (i = PAGE_SIZE/sizeof (struct buffer_head) ; i-- > 0 ; bh++) {
+		bh->b_next_free = unused_list;
+		unused_list = bh;
+		nr_unused++;
+	}
+	return 1;
+}
+
+/*
+ * resize_hash() keeps the hash chains around 6 buffers long as the cache
+ * grows and shrinks. The boot table is used for the smallest size, the
+ * others all fit in one page.
+ */
+static int hash_sizes[] = {NR_HASH, 509, 769, 1021};
+
+static void resize_hash(void)
+{
+	struct buffer_head ** table, * list, * bh;
+	int i, size;
+
+	if (NR_BUFFERS <= 8*nr_hash &&
+	    (nr_hash == NR_HASH || NR_BUFFERS >= 4*nr_hash))
+		return;
+	size = NR_HASH;
+	for (i = 1 ; i < sizeof (hash_sizes)/sizeof (int) ; i++)
+		if (hash_sizes[i]*6 <= NR_BUFFERS)
+			size = hash_sizes[i];
+	if (size == nr_hash)
+		return;
+	if (size == NR_HASH)
+		table = boot_hash;
+	else if (hash_table != boot_hash)
+		table = hash_table;
+	else if (!(table = (struct buffer_head **) get_free_page()))
+		return;
+	list = NULL;
+	for (i = 0 ; i < nr_hash ; i++)
+		while ((bh = hash_table[i])) {
+			hash_table[i] = bh->b_next;
+			bh->b_next = list;
+			list = bh;
+		}
+	if (hash_table != table && hash_table != boot_hash)
+		free_page((unsigned long) hash_table);
+	hash_table = table;
+	nr_hash = size;
+	for (i = 0 ; i < nr_hash ; i++)
+		hash_table[i] = NULL;
+	while ((bh = list)) {
+		list = bh->b_next;
+		insert_into_hash(bh);
+	}
+}
+
+static void grow_buffers(void)
+{
+	struct buffer_head * bh, * tmp, * last;
+	unsigned long page;
+	int i;
+
+	if (nr_free_pages <= bdf_prm.b_un.grow_free)
+		return;
+	if (nr_unused < PAGE_SIZE/BLOCK_SIZE && !get_more_buffer_heads())
+		return;
+	if (!(page = __get_free_page()))	/* blocks are read into it */
+		return;
+	bh = last = NULL;
+	for (i = 0 ; i < PAGE_SIZE/BLOCK_SIZE ; i++) {
+		tmp = unused_list;
+		unused_list = tmp->b_next_free;
+		nr_unused--;
+		tmp->b_data = (char *) (page + i*BLOCK_SIZE);
+		tmp->b_dev = 0;
+		tmp->b_uptodate = 0;
+		tmp->b_dirt = 0;
+		tmp->b_count = 0;
+		tmp->b_lock = 0;
+		tmp->b_list = NR_LIST;
+		tmp->b_ahead = 0;
+		tmp->b_hot = 0;
+		tmp->b_wait = NULL;
+		tmp->b_end_io = NULL;
+		tmp->b_acct = 0;
+		tmp->b_next = tmp->b_prev = NULL;
+		tmp->b_this_page = bh;
+		if (!bh)
+			last = tmp;
+		bh = tmp;
+		cli();
+		append_to_lru(bh,BUF_FREE);
+		sti();
+		NR_BUFFERS++;
+	}
+	last->b_this_page = bh;
+	buffer_stat.grow_pages++;
+	resize_hash();
+}
+
+#define buffer_idle(bh) ((bh)->b_list == BUF_FREE || \
+(bh)->b_list == BUF_NEW || (bh)->b_list == BUF_CLEAN)
+
+/*
+ * Give back the page of 'bh', whose buffers all are idle. Called with
+ * interrupts off.
+ */
+static void free_buffer_page(struct buffer_head * bh)
+{
+	struct buffer_head * tmp;
+	int i;
+
+	free_page((unsigned long) bh->b_data & 0xfffff000);
+	for (i = 0 ; i < PAGE_SIZE/BLOCK_SIZE ; i++) {
+		tmp = bh->b_this_page;
+		remove_from_lru(bh);
+		remove_from_hash(bh);
+		bh->b_dev = 0;
+		bh->b_this_page = NULL;
+		bh->b_next_free = unused_list;
+		unused_list = bh;
+		nr_unused++;
+		NR_BUFFERS--;
+		bh = tmp;
+	}
+	buffer_stat.shrink_pages++;
+}
+
+/*
+ * shrink_buffers() gives back at most 'nr' pages, taking the empty
+ * buffers first, then the least recently used ones. Returns the number
+ * of pages it freed.
+ */
+int shrink_buffers(int nr)
+{
+	static int lists[] = {BUF_FREE, BUF_NEW, BUF_CLEAN};
+	struct buffer_head * bh, * tmp;
+	int i, j, freed = 0;
+
+	cli();
+	for (j = 0 ; j < 3 && freed < nr ; j++) {
+repeat:
+		bh = lru_list[lists[j]];
+		for (i = nr_buffers_type[lists[j]] ; i-- > 0 ;
+		    bh = bh->b_next_free) {
+			if (!bh->b_this_page)
+				continue;
+			for (tmp = bh->b_this_page ; tmp != bh ;
+			    tmp = tmp->b_this_page)
+				if (!buffer_idle(tmp))
+					break;
+			if (tmp != bh)
+				continue;
+			free_buffer_page(bh);
+			if (++freed >= nr)
+				break;
+			goto repeat;
+		}
+	}
+	sti();
+	if (freed)
+		resize_hash();
+	return freed;
+}
+
 /*
  * Ok, this is getblk, and it isn't very clear, again to hinder
  * race-conditions. Most of the code is seldom used, (ie repeating),
@@ -191,58 +647,82 @@ repeat:
  *
  * XXX:XXX
  *     Check if block is present in the hash table list, return
- *     Go to the free list of buffer, and find a free block
+ *     Else take a clean buffer: that is just the head of one of the
+ *     clean lists, no searching needed. If there are no empty ones,
+ *     and memory to spare, the cache grows first. Only if there are
+ *     no clean buffers at all do we have to write something back.
  */
 struct buffer_head * getblk(int dev,int block)
 {
 	struct buffer_head * tmp;
+	int i;
 
 repeat:
-	if (tmp=get_hash_table(dev,block))
+	if ((tmp=get_hash_table(dev,block))) {
+		buffer_stat.hits++;
 		return tmp;
-	tmp = free_list;
-	do {
-		if (!tmp->b_count) {
-			wait_on_buffer(tmp);	/* we still have to wait */
-			if (!tmp->b_count)	/* on it, it might be dirty */
+	}
+	if (!lru_list[BUF_FREE])
+		grow_buffers();
+	cli();
+	tmp = get_free_buffer();
+	sti();
+	if (!tmp) {
+/*
+ * No clean buffers. Take the oldest unused dirty one. If every buffer
+ * is in use or under I/O, we have to wait for one to be freed.
+ */
+		tmp = lru_list[BUF_DIRTY];
+		for (i = nr_buffers_type[BUF_DIRTY] ; i > 0 ; i--) {
+			if (!tmp->b_count)
 				break;
+			tmp = tmp->b_next_free;
+		}
+		if (i <= 0) {
+			printk("Sleeping on free buffer ..");
+			sleep_on(&buffer_wait);
+			printk("ok\n");
+			goto repeat;
+		}
+		tmp->b_count++;
+		write_cluster(tmp); // XXX:XXX WE WRITE BACK THE BUFFER INTO DISK, ONLY WHEN WE NEED THAT 
+                        //         BUFFER, WHICH IS NOT BEING USED, BUT IS DIRTY.
+/*
+ * NOTE!! While we slept in write_cluster(), somebody else might have
+ * added "this" block already, so check for that. Thank God for goto's.
+ * Somebody might also have started using or dirtied our victim, in
+ * which case we just let it go and start over.
+ */
+		if (find_buffer(dev,block) || tmp->b_count != 1 ||
+		    tmp->b_dirt || tmp->b_lock) {
+			brelse(tmp);
+			goto repeat;
 		}
-		tmp = tmp->b_next_free;
-	} while (tmp != free_list || (tmp=NULL));
-	/* Kids, don't try THIS at home ^^^^^. Magic */
-	if (!tmp) {
-		printk("Sleeping on free buffer ..");
-		sleep_on(&buffer_wait);
-		printk("ok\n");
-		goto repeat;
 	}
-	tmp->b_count++;
-	remove_from_queues(tmp);
 /*
- * Now, when we know nobody can get to this node (as it's removed from the
- * free list), we write it out. We can sleep here without fear of race-
- * conditions.
+ * A clean, unlocked buffer only we use, and nobody has added this
+ * block since we last looked.
  */
-	if (tmp->b_dirt)
-		sync_dev(tmp->b_dev); // XXX:XXX WE WRITE BACK THE BUFFER INTO DISK, ONLY WHEN WE NEED THAT 
-                          //         BUFFER, WHICH IS NOT BEING USED, BUT IS DIRTY.
+	if (tmp->b_dev)
+		buffer_stat.evictions++;
+	if (tmp->b_ahead)
+		buffer_stat.ra_misses++;
+	buffer_stat.misses++;
+	remove_from_hash(tmp);
 /* update buffer contents */
 	tmp->b_dev=dev;
 	tmp->b_blocknr=block;
 	tmp->b_dirt=0;
 	tmp->b_uptodate=0;
-/* NOTE!! While we possibly slept in sync_dev(), somebody else might have
- * added "this" block already, so check for that. Thank God for goto's.
- */
-	if (find_buffer(dev,block)) {
-		tmp->b_dev=0;		/* ok, someone else has beaten us, (allocated already) */
-		tmp->b_blocknr=0;	/* to it - free this block and */
-		tmp->b_count=0;		/* try again */
-		insert_into_queues(tmp);
-		goto repeat;
+	tmp->b_ahead=0;
+	tmp->b_hot=0;
+	if (bdf_prm.b_un.policy && ghost[_ghostfn(dev,block)] == GHOST(dev,block)) {
+		ghost[_ghostfn(dev,block)] = 0;
+		tmp->b_hot=1;
+		buffer_stat.ghost_hits++;
 	}
 /* and then insert into correct position */
-	insert_into_queues(tmp);
+	insert_into_hash(tmp);
 	return tmp;
 }
 
@@ -252,7 +732,8 @@ repeat:
 //         by someone
 //
 //         brelse is just decrementing refcount
-//         by 1
+//         by 1, and putting the buffer back on
+//         the lru-list if it isn't used any more
 void brelse(struct buffer_head * buf)
 {
 	if (!buf)
@@ -260,13 +741,151 @@ void brelse(struct buffer_head * buf)
 	wait_on_buffer(buf); // XXX:XXX Lock
 	if (!(buf->b_count--))
 		panic("Trying to free free buffer");
-	wake_up(&buffer_wait); // XXX:XXX Unlock
+	refile_buffer(buf); // XXX:XXX wakes up buffer_wait if it is free now
+}
+
+/*
+ * The writeback daemon. It is started by init (instead of the old
+ * /bin/update that just called sync() now and then) and never returns
+ * to user mode. Every 'interval' ticks - or earlier, if too many
+ * buffers get dirty - it copies the dirty inodes into their blocks, and
+ * writes back the buffers that have been dirty for longer than
+ * 'age_buffer'. It writes at most 'ndirty' blocks at a time, sorted by
+ * block, and rests 'nap' ticks in between, so reads don't have to
+ * queue up behind a long run of writes. Then it shrinks the cache if
+ * memory is short.
+ */
+static void wakeup_bdflush(void)
+{
+	bdflush_timer = 0;
+	wake_up(&bdflush_wait);
+}
+
+static void bdflush_sleep(long ticks)
+{
+	if (!bdflush_timer) {
+		bdflush_timer = 1;
+		add_timer(ticks,wakeup_bdflush);
+	}
+	sleep_on(&bdflush_wait);
+}
+
+/*
+ * Write one batch of old buffers, the dirty list is oldest first. Returns
+ * 1 if there are more to do. We don't wait for the writes: the buffers
+ * are on the locked list until they are done, and the nap keeps us from
+ * flooding the request queue.
+ */
+static int flush_old_buffers(void)
+{
+	struct buffer_head * list[NR_BATCH], * bh, * tmp;
+	int i, j, n;
+
+	n = 0;
+	bh = lru_list[BUF_DIRTY];
+	for (i = nr_buffers_type[BUF_DIRTY] ; i-- > 0 &&
+	    n < bdf_prm.b_un.ndirty ; bh = bh->b_next_free) {
+		if (!too_many_dirty() &&
+		    jiffies - bh->b_dirtime < bdf_prm.b_un.age_buffer)
+			break;
+		bh->b_count++;
+		for (j = n++ ; j > 0 && (list[j-1]->b_dev > bh->b_dev ||
+		    (list[j-1]->b_dev == bh->b_dev &&
+		    list[j-1]->b_blocknr > bh->b_blocknr)) ; j--)
+			list[j] = list[j-1];
+		list[j] = bh;
+	}
+	plug_blocks();
+	for (i = 0 ; i < n ; i++) {
+		tmp = list[i];
+		if (tmp->b_dirt) {
+			buffer_stat.flush_writes++;
+			ll_rw_block(WRITE,tmp);
+		}
+	}
+	unplug_blocks();
+	for (i = 0 ; i < n ; i++)
+		bforget(list[i]);
+	return n >= bdf_prm.b_un.ndirty;
+}
+
+static void bdflush(void)
+{
+	for (;;) {
+		bdflush_sleep(bdf_prm.b_un.interval);
+		buffer_stat.flush_runs++;
+		sync_inodes();
+		while (flush_old_buffers())
+			if (bdf_prm.b_un.nap)
+				bdflush_sleep(bdf_prm.b_un.nap);
+		if (nr_free_pages < bdf_prm.b_un.shrink_free)
+			shrink_buffers(bdf_prm.b_un.shrink_free - nr_free_pages);
+	}
+}
+
+/*
+ * sys_bdflush(func,data):
+ *	func 0:	become the writeback daemon, never returns
+ *	func 1:	copy a struct buffer_stat to user space 'data'
+ *	func 2n+2, 2n+3: read parameter n into user space long 'data',
+ *		or set it to 'data'. The parameters are those of bdf_prm,
+ *		in order, the read-ahead window and cache size limits
+ *		included. The read-ahead window is at least one block,
+ *		and ra_min may not be set above ra_max.
+ */
+int sys_bdflush(int func, long data)
+{
+	long * p, old;
+	int i;
+
+	if (func == 1) {
+		verify_area((void *) data,sizeof (struct buffer_stat));
+		buffer_stat.nr_buffers = NR_BUFFERS;
+		buffer_stat.nr_hash = nr_hash;
+		for (i = 0 ; i < NR_LIST ; i++)
+			buffer_stat.nr_type[i] = nr_buffers_type[i];
+		p = (long *) &buffer_stat;
+		for (i = 0 ; i < sizeof (struct buffer_stat)/sizeof (long) ; i++)
+			put_fs_long(p[i],i+(unsigned long *) data);
+		return 0;
+	}
+	if (!func) {
+		if (current->euid)
+			return -EPERM;
+		if (bdflush_task)
+			return -EBUSY;
+		bdflush_task = current;
+		bdflush();
+	}
+	i = (func-2) >> 1;
+	if (func < 0 || i >= NR_BDF_PARAM)
+		return -EINVAL;
+	if (!(func & 1)) {
+		verify_area((void *) data,sizeof (long));
+		put_fs_long(bdf_prm.data[i],(unsigned long *) data);
+		return 0;
+	}
+	if (current->euid)
+		return -EPERM;
+	if (data < bdflush_min[i] || data > bdflush_max[i])
+		return -EINVAL;
+	old = bdf_prm.data[i];
+	bdf_prm.data[i] = data;
+	if (bdf_prm.b_un.ra_min > bdf_prm.b_un.ra_max) {
+		bdf_prm.data[i] = old;	/* the window couldn't grow or shrink */
+		return -EINVAL;
+	}
+	return 0;
 }
 
 /*
  * bread() reads a specified block and returns the buffer that contains
  * it. It returns NULL if the block was unreadable.
  *
+ * File data is read with breada(), so bread() is what the filesystem
+ * uses for its inodes, bitmaps, directories and indirect blocks, and
+ * its hits and misses are counted as those of the metadata.
+ *
  *
  * XXX:XXX
  *     read the block,
@@ -277,28 +896,167 @@ struct buffer_head * bread(int dev,int block)
 
 	if (!(bh=getblk(dev,block)))
 		panic("bread: getblk returned NULL\n");
+	if (bh->b_uptodate) {
+		buffer_stat.meta_hits++;
+		return bh;
+	}
+	buffer_stat.meta_misses++;
+	ll_rw_block(READ,bh);
+	wait_on_buffer(bh);
+	if (bh->b_uptodate)
+		return bh;
+	brelse(bh);
+	return (NULL);
+}
+
+
+/*
+ * breada() is like bread(), but also starts reading the blocks in
+ * 'ahead' (n of them). It only waits for the first block: the others
+ * are READA requests, which the driver may drop if it has no room.
+ * With n==0 it is just bread() for file data.
+ */
+struct buffer_head * breada(int dev,int block,int * ahead,int n)
+{
+	struct buffer_head * bh, * tmp;
+
+	if (!(bh=getblk(dev,block)))
+		panic("breada: getblk returned NULL\n");
+	if (bh->b_uptodate)
+		buffer_stat.data_hits++;
+	else
+		buffer_stat.data_misses++;
+	plug_blocks();
+	if (!bh->b_uptodate && !bh->b_lock)
+		ll_rw_block(READA,bh);
+	while (n-- > 0) {
+		tmp = getblk(dev,*(ahead++));
+		if (!tmp->b_uptodate && !tmp->b_lock) {
+			ll_rw_block(READA,tmp);
+			if (tmp->b_lock || tmp->b_uptodate) {
+				tmp->b_ahead = 1;
+				buffer_stat.ra_blocks++;
+			}
+		}
+		bforget(tmp);
+	}
+	unplug_blocks();
+	wait_on_buffer(bh);
 	if (bh->b_uptodate)
 		return bh;
 	ll_rw_block(READ,bh);
+	wait_on_buffer(bh);
 	if (bh->b_uptodate)
 		return bh;
 	brelse(bh);
 	return (NULL);
 }
 
+/*
+ * bread_multi() reads the n blocks in 'block' into 'bh'. Every block
+ * that isn't cached is handed to the driver before we wait for any of
+ * them, so they are sorted together in the request queue and we only
+ * really sleep once. A zero block, or one that can't be read, gets a
+ * NULL buffer. The caller brelse()s the others.
+ */
+void bread_multi(int dev,int * block,struct buffer_head ** bh,int n)
+{
+	int i;
+
+	plug_blocks();
+	for (i = 0 ; i < n ; i++) {
+		if (!block[i]) {
+			bh[i] = NULL;
+			continue;
+		}
+		if (!(bh[i]=getblk(dev,block[i])))
+			panic("bread_multi: getblk returned NULL\n");
+		if (bh[i]->b_uptodate) {
+			buffer_stat.meta_hits++;
+			continue;
+		}
+		buffer_stat.meta_misses++;
+		if (!bh[i]->b_lock)
+			ll_rw_block(READ,bh[i]);
+	}
+	unplug_blocks();
+	for (i = 0 ; i < n ; i++) {
+		if (!bh[i])
+			continue;
+		wait_on_buffer(bh[i]);
+		if (bh[i]->b_uptodate)
+			continue;
+		ll_rw_block(READ,bh[i]);	/* try once more */
+		wait_on_buffer(bh[i]);
+		if (bh[i]->b_uptodate)
+			continue;
+		brelse(bh[i]);
+		bh[i] = NULL;
+	}
+}
+
+/*
+ * readahead() keeps track of how 'filp' is read. Call it with the block
+ * that is wanted now: if the reads are sequential and the reader is
+ * getting close to the end of what has been read ahead, it fills in
+ * the next blocks to read ahead, and returns how many there are.
+ *
+ * The window doubles (up to ra_max) as long as the blocks read ahead
+ * are still in the cache when they are wanted, and is halved (down to
+ * ra_min) when they were not. A non-sequential read turns it off.
+ */
+int readahead(struct file * filp,int block,int * ahead)
+{
+	int i, n;
+
+	if (block != filp->f_ranext) {
+		filp->f_ranext = block+1;
+		filp->f_raend = 0;
+		filp->f_rawin = 0;
+		return 0;
+	}
+	filp->f_ranext = block+1;
+	if (block + (filp->f_rawin>>1) < filp->f_raend)
+		return 0;
+	if (!filp->f_raend)
+		filp->f_rawin = bdf_prm.b_un.ra_min;
+	else if (filp->f_rahit)
+		filp->f_rawin <<= 1;
+	else
+		filp->f_rawin >>= 1;
+	if (filp->f_rawin > bdf_prm.b_un.ra_max)
+		filp->f_rawin = bdf_prm.b_un.ra_max;
+	if (filp->f_rawin < bdf_prm.b_un.ra_min)
+		filp->f_rawin = bdf_prm.b_un.ra_min;
+	i = (filp->f_raend > block) ? filp->f_raend : block+1;
+	filp->f_raend = block+1+filp->f_rawin;
+	for (n = 0 ; i < filp->f_raend ; i++)
+		ahead[n++] = i;
+	return n;
+}
+
+/*
+ * readahead_done() is called with the buffer the reader got, to see if
+ * read-ahead brought it in.
+ */
+void readahead_done(struct file * filp,struct buffer_head * bh)
+{
+	if ((filp->f_rahit = bh->b_ahead)) {
+		bh->b_ahead = 0;
+		buffer_stat.ra_hits++;
+	}
+}
 
 /*
  * 1/
  * Make all the buffers clear
- * and make a free block list
+ * and put them on the free list
  * Which are just inside Raw Ram.
  * from start location to end.
  * 
- * Free block list are just, an array
+ * The buffer heads are just, an array
  * in the begining.
  *
- * They are not even in the free list of blocks
- *
  * 2/
  * Make all hash list NULL
  */
@@ -314,21 +1072,49 @@ void buffer_init(void)
 		h->b_count = 0;
 		h->b_lock = 0;
 		h->b_uptodate = 0;
+		h->b_list = NR_LIST;
+		h->b_ahead = 0;
+		h->b_hot = 0;
 		h->b_wait = NULL;
+		h->b_end_io = NULL;
+		h->b_acct = 0;
 		h->b_next = NULL;
 		h->b_prev = NULL;
+		h->b_this_page = NULL;
 		h->b_data = (char *) b;
-		h->b_prev_free = h-1;
-		h->b_next_free = h+1;
+		append_to_lru(h,BUF_FREE);
 		h++;
 		NR_BUFFERS++;
 		if (b == (void *) 0x100000)
 			b = (void *) 0xA0000;
 	}
-	h--;
-	free_list = start_buffer;
-	free_list->b_prev_free = h;
-	h->b_next_free = free_list;
-	for (i=0;i<NR_HASH;i++)
-		hash_table[i]=NULL;
+	for (i=0;i<NR_HASH;i++) {
+		boot_hash[i]=NULL;
+		ghost[i]=0;
+	}
 }	
+
+void show_buffers(void)
+{
+	printk("%d buffers: %d free, %d clean (%d new), %d locked, %d dirty\n\r",
+		NR_BUFFERS,nr_buffers_type[BUF_FREE],
+		nr_buffers_type[BUF_CLEAN]+nr_buffers_type[BUF_NEW],
+		nr_buffers_type[BUF_NEW],nr_buffers_type[BUF_LOCKED],
+		nr_buffers_type[BUF_DIRTY]);
+	printk("%d hash chains, %d pages grown, %d given back\n\r",
+		nr_hash,buffer_stat.grow_pages,buffer_stat.shrink_pages);
+	printk("%s: metadata %d hits, %d misses, data %d hits, %d misses, "
+		"%d ghost hits\n\r",bdf_prm.b_un.policy?"2Q":"LRU",
+		buffer_stat.meta_hits,buffer_stat.meta_misses,
+		buffer_stat.data_hits,buffer_stat.data_misses,
+		buffer_stat.ghost_hits);
+	printk("%d hits, %d misses, %d evictions (%d blocks written)\n\r",
+		buffer_stat.hits,buffer_stat.misses,buffer_stat.evictions,
+		buffer_stat.evict_writes);
+	printk("bdflush: %d runs (%d early), %d blocks written\n\r",
+		buffer_stat.flush_runs,buffer_stat.flush_early,
+		buffer_stat.flush_writes);
+	printk("read-ahead: %d blocks, %d used, %d wasted\n\r",
+		buffer_stat.ra_blocks,buffer_stat.ra_hits,
+		buffer_stat.ra_misses);
+}
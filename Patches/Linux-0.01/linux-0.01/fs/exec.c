@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <a.out.h>
 
@@ -8,159 +9,30 @@
 #include <linux/mm.h>
 #include <asm/segment.h>
 
-extern int sys_exit(int exit_code);
 extern int sys_close(int fd);
 
 /*
- * XXX:XXX RAM for a process given as pages
- *
- * MAX_ARG_PAGES defines the number of pages allocated for arguments
- * and envelope for the new program. 32 should suffice, this gives
- * a maximum env+arg of 128kB !
- */
-#define MAX_ARG_PAGES 32
-
-#define cp_block(from,to) \
-__asm__("pushl $0x10\n\t" \
-	"pushl $0x17\n\t" \
-	"pop %%es\n\t" \
-	"cld\n\t" \
-	"rep\n\t" \
-	"movsl\n\t" \
-	"pop %%es" \
-	::"c" (BLOCK_SIZE/4),"S" (from),"D" (to) \
-	:"cx","di","si")
-
-/*
- * 
- * read_head() reads blocks 1-6 (not 0). Block 0 has already been
- * read for header information.
- *
- * XXX:XXX
- *     See above comment, so inode is just 8 blocks.
- *     0      :  contains the header info(see in do_execve().
- *     1-6    :  direct block
- *     7      :  1st level indirect block
- *     8      :  2nd level indirect block
- *
- *
- * XXX:XXX 
- *     load first 6 blocks of
- *     the source code inode
- *     into the process_address_apace/page(RAM).
- *
- *     ????? Are there direct blocks
- *           Because bellow we are 
- *           reading the indirect blocks
+ * The other half of text_busy() in namei.c: a file open for writing
+ * can't be run, as its pages are read only as they are used.
  */
-int read_head(struct m_inode * inode,int blocks)
+static int write_busy(struct m_inode * inode)
 {
-	struct buffer_head * bh;
-	int count;
+	struct file * f;
 
-	if (blocks>6)
-		blocks=6;
-	for(count = 0 ; count<blocks ; count++) {
-		if (!inode->i_zone[count+1])
-			continue;
-		if (!(bh=bread(inode->i_dev,inode->i_zone[count+1])))
-			return -1;
-		cp_block(bh->b_data,count*BLOCK_SIZE);
-		brelse(bh);
-	}
+	for (f = file_table ; f < file_table+NR_FILE ; f++)
+		if (f->f_count && f->f_inode == inode && (f->f_flags & O_ACCMODE))
+			return 1;
 	return 0;
 }
 
-
 /*
- * XXX:XXX
- *     Read 1st level indirect blocks into process address_space/pages/memory.
- *     dev   : device number
- *     ind   : block with contais
- *             the block number of
- *             the indirect blocks
- *     size  : total size, of the
- *             data to be read from
- *             the indirect blocks
- *
- * load the ceil(size/BLOCK_SIZE) number of blocks
- * into the RAM (Pages, vertual address space),
- * starting from the given offset of the Vertual Address Space
- * of the process
- *
- */
-int read_ind(int dev,int ind,long size,unsigned long offset)
-{
-	struct buffer_head * ih, * bh;
-	unsigned short * table,block;
-
-	if (size<=0)
-		panic("size<=0 in read_ind");
-	if (size>512*BLOCK_SIZE)
-		size=512*BLOCK_SIZE;
-	if (!ind)
-		return 0;
-	if (!(ih=bread(dev,ind)))
-		return -1;
-	table = (unsigned short *) ih->b_data; // store the block number into table var
-                                         // do first entry of the block is block number
-                                         // because we are just inreasething that var
-                                         // by 1 to 
-	while (size>0) {
-		if (block=*(table++))
-			if (!(bh=bread(dev,block))) {
-				brelse(ih);
-				return -1;
-			} else {
-				cp_block(bh->b_data,offset);
-				brelse(bh);
-			}
-		size -= BLOCK_SIZE;
-		offset += BLOCK_SIZE;
-	}
-	brelse(ih);
-	return 0;
-}
-
-/*
- * read_area() reads an area into %fs:mem.
- *
+ * XXX:XXX RAM for a process given as pages
  *
- * XXX:XXX
- *     Read the executable into 
- *     process address_space/RAM/memory
+ * MAX_ARG_PAGES defines the number of pages allocated for arguments
+ * and envelope for the new program. 32 should suffice, this gives
+ * a maximum env+arg of 128kB !
  */
-int read_area(struct m_inode * inode,long size)
-{
-	struct buffer_head * dind;
-	unsigned short * table;
-	int i,count;
-
-  // First read 1-6 direct blocks
-	if ((i=read_head(inode,(size+BLOCK_SIZE-1)/BLOCK_SIZE)) ||
-	    (size -= BLOCK_SIZE*6)<=0)
-		return i;
-  // Then read 1st level indirect blocks, which block number
-  // is in direct block number 7, i_zone[7] block.
-  // there can be 512 entries of indirect blocks.
-	if ((i=read_ind(inode->i_dev,inode->i_zone[7],size,BLOCK_SIZE*6)) ||
-	    (size -= BLOCK_SIZE*512)<=0)
-		return i;
-	if (!(i=inode->i_zone[8]))
-		return 0;
-  // read direct 8th block, which contains the 
-  // 2nd - level indirect block entries.
-	if (!(dind = bread(inode->i_dev,i)))
-		return -1;
-	table = (unsigned short *) dind->b_data;
-	for(count=0 ; count<512 ; count++)
-		if ((i=read_ind(inode->i_dev,*(table++),size,
-		    BLOCK_SIZE*(518+count))) || (size -= BLOCK_SIZE*512)<=0)
-			return i;
-  // now executable size is greater than
-  // (6 * BLOCK_SIZE) + (512 * BLOCK_SIZE) + (512 * 512 * BLOCK_SIZE) 
-	panic("Impossibly long executable");
-}
+#define MAX_ARG_PAGES 32
 
 /* XXX:XXX ?????
  * create_tables() parses the env- and arg-strings in new user
@@ -297,6 +169,10 @@ int do_execve(unsigned long * eip,long tmp,char * filename,
 		iput(inode);
 		return -EACCES;
 	}
+	if (write_busy(inode)) {
+		iput(inode);
+		return -ETXTBSY;
+	}
 	i = inode->i_mode;
 	if (current->uid && current->euid) {
 		if (current->euid == inode->i_uid)
@@ -371,18 +247,11 @@ int do_execve(unsigned long * eip,long tmp,char * filename,
                                       // Heap will grow bottom to top
                                       // means brk to above
 	current->start_stack = p & 0xfffff000; // stack will grow top to bottom
-  // XXX: read the executable into proceess address space
-	i = read_area(inode,ex.a_text+ex.a_data);
-	iput(inode); // Free inode structure, not pages
-	if (i<0)
-		sys_exit(-1); // free the resource, 
-                  // ( pages + .... )
-                  // NULL the task in global task table
-                  // give SIGCHLD, to its parent.
-                  // call sheduler() function.
-	i = ex.a_text+ex.a_data;
-	while (i&0xfff) // XXX: ?????
-		put_fs_byte(0,(char *) (i++));
+  // XXX: the executable isn't read in here: do_no_page() reads
+  //      each page of it when it is first used, from the inode
+  //      we keep in current->executable.
+	iput(current->executable);
+	current->executable = inode;
   // XXX: ?????
 	eip[0] = ex.a_entry;		/* eip, magic happens :-) */
 	eip[3] = p;			/* stack pointer */
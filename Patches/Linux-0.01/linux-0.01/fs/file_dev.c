@@ -10,15 +10,24 @@
 
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
-	int left,chars,nr;
+	int left,chars,nr,block,i,j,n;
+	int ahead[NR_AHEAD];
 	struct buffer_head * bh;
 
 	if ((left=count)<=0)
 		return 0;
 	while (left) {
-		if (nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE)) {
-			if (!(bh=bread(inode->i_dev,nr)))
+		block = (filp->f_pos)/BLOCK_SIZE;
+		n = readahead(filp,block,ahead);
+		for (i = j = 0 ; i < n ; i++)	/* only what's in the file */
+			if (ahead[i]*BLOCK_SIZE < inode->i_size &&
+			    (nr = bmap(inode,ahead[i])))
+				ahead[j++] = nr;
+		n = j;
+		if ((nr = bmap(inode,block))) {
+			if (!(bh=breada(inode->i_dev,nr,ahead,n)))
 				break;
+			readahead_done(filp,bh);
 		} else
 			bh = NULL;
 		nr = filp->f_pos % BLOCK_SIZE;
@@ -58,11 +67,11 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 	while (i<count) {
 		if (!(block = create_block(inode,pos/BLOCK_SIZE)))
 			break;
-		if (!(bh=bread(inode->i_dev,block)))
+		if (!(bh=breada(inode->i_dev,block,NULL,0)))
 			break;
 		c = pos % BLOCK_SIZE;
 		p = c + bh->b_data;
-		bh->b_dirt = 1;
+		mark_buffer_dirty(bh);
 		c = BLOCK_SIZE-c;
 		if (c > count-i) c = count-i;
 		pos += c;
@@ -76,6 +85,7 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 		brelse(bh);
 	}
 	inode->i_mtime = CURRENT_TIME;
+	invalidate_text(inode->i_dev,inode->i_num);
 	if (!(filp->f_flags & O_APPEND)) {
 		filp->f_pos = pos;
 		inode->i_ctime = CURRENT_TIME;
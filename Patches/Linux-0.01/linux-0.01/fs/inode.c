@@ -79,7 +79,7 @@ static int _bmap(struct m_inode * inode,int block,int create)
 		if (create && !i)
 			if (i=new_block(inode->i_dev)) {
 				((unsigned short *) (bh->b_data))[block]=i;
-				bh->b_dirt=1;
+				mark_buffer_dirty(bh);
 			}
 		brelse(bh);
 		return i;
@@ -98,7 +98,7 @@ static int _bmap(struct m_inode * inode,int block,int create)
 	if (create && !i)
 		if (i=new_block(inode->i_dev)) {
 			((unsigned short *) (bh->b_data))[block>>9]=i;
-			bh->b_dirt=1;
+			mark_buffer_dirty(bh);
 		}
 	brelse(bh);
 	if (!i)
@@ -109,7 +109,7 @@ static int _bmap(struct m_inode * inode,int block,int create)
 	if (create && !i)
 		if (i=new_block(inode->i_dev)) {
 			((unsigned short *) (bh->b_data))[block&511]=i;
-			bh->b_dirt=1;
+			mark_buffer_dirty(bh);
 		}
 	brelse(bh);
 	return i;
@@ -341,7 +341,7 @@ static void write_inode(struct m_inode * inode)
 	((struct d_inode *)bh->b_data) // block where this inode entry resides
 		[(inode->i_num-1)%INODES_PER_BLOCK] // offset inside the block where this inode entry resides 
 			= *(struct d_inode *)inode;
-	bh->b_dirt=1;
+	mark_buffer_dirty(bh);
 	inode->i_dirt=0;
 	brelse(bh);
 	unlock_inode(inode);
@@ -74,13 +74,16 @@ static int match(int len,const char * name,struct dir_entry * de)
  * returns the cache buffer in which the entry was found, and the entry
  * itself (as a parameter - res_dir). It does NOT read the inode of the
  * entry - you'll have to do that yourself if you want to.
+ *
+ * The directory blocks are read NR_MULTI at a time with bread_multi().
  */
 static struct buffer_head * find_entry(struct m_inode * dir,
 	const char * name, int namelen, struct dir_entry ** res_dir)
 {
-	int entries;
-	int block,i;
-	struct buffer_head * bh;
+	int entries, nblocks;
+	int block[NR_MULTI];
+	int i,j,k,n;
+	struct buffer_head * bh[NR_MULTI];
 	struct dir_entry * de;
 
 #ifdef NO_TRUNCATE
@@ -94,31 +97,29 @@ static struct buffer_head * find_entry(struct m_inode * dir,
 	*res_dir = NULL;
 	if (!namelen)
 		return NULL;
-	if (!(block = dir->i_zone[0]))
-		return NULL;
-	if (!(bh = bread(dir->i_dev,block)))
+	if (!dir->i_zone[0])
 		return NULL;
-	i = 0;
-	de = (struct dir_entry *) bh->b_data;
-	while (i < entries) {
-		if ((char *)de >= BLOCK_SIZE+bh->b_data) {
-			brelse(bh);
-			bh = NULL;
-			if (!(block = bmap(dir,i/DIR_ENTRIES_PER_BLOCK)) ||
-			    !(bh = bread(dir->i_dev,block))) {
-				i += DIR_ENTRIES_PER_BLOCK;
+	nblocks = (entries + DIR_ENTRIES_PER_BLOCK - 1) / DIR_ENTRIES_PER_BLOCK;
+	for (i = 0 ; i < nblocks ; i += n) {
+		for (n = 0 ; n < NR_MULTI && i+n < nblocks ; n++)
+			block[n] = bmap(dir,i+n);
+		bread_multi(dir->i_dev,block,bh,n);
+		for (j = 0 ; j < n ; j++) {
+			if (!bh[j])
 				continue;
-			}
-			de = (struct dir_entry *) bh->b_data;
+			de = (struct dir_entry *) bh[j]->b_data;
+			for (k = (i+j)*DIR_ENTRIES_PER_BLOCK ;
+			    k < entries && k < (i+j+1)*DIR_ENTRIES_PER_BLOCK ;
+			    k++,de++)
+				if (match(namelen,name,de)) {
+					*res_dir = de;
+					for (k = j+1 ; k < n ; k++)
+						brelse(bh[k]);
+					return bh[j];
+				}
+			brelse(bh[j]);
 		}
-		if (match(namelen,name,de)) {
-			*res_dir = de;
-			return bh;
-		}
-		de++;
-		i++;
 	}
-	brelse(bh);
 	return NULL;
 }
 
@@ -178,7 +179,7 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 			dir->i_mtime = CURRENT_TIME;
 			for (i=0; i < NAME_LEN ; i++)
 				de->name[i]=(i<namelen)?get_fs_byte(name+i):0;
-			bh->b_dirt = 1;
+			mark_buffer_dirty(bh);
 			*res_dir = de;
 			return bh;
 		}
@@ -299,6 +300,21 @@ struct m_inode * namei(const char * pathname)
 	return dir;
 }
 
+/*
+ * A running program is read from its file as it is used, see
+ * do_no_page(), so the file may not be opened for writing while any
+ * process runs it: that would change the code under its feet.
+ */
+static int text_busy(struct m_inode * inode)
+{
+	struct task_struct ** p;
+
+	for (p = &FIRST_TASK ; p <= &LAST_TASK ; p++)
+		if (*p && (*p)->executable == inode)
+			return 1;
+	return 0;
+}
+
 /*
  *	open_namei()
  *
@@ -352,7 +368,7 @@ int open_namei(const char * pathname, int flag, int mode,
 			return -ENOSPC;
 		}
 		de->inode = inode->i_num;
-		bh->b_dirt = 1;
+		mark_buffer_dirty(bh);
 		brelse(bh);
 		iput(dir);
 		*res_inode = inode;
@@ -371,6 +387,10 @@ int open_namei(const char * pathname, int flag, int mode,
 		iput(inode);
 		return -EPERM;
 	}
+	if ((flag & O_ACCMODE) && text_busy(inode)) {
+		iput(inode);
+		return -ETXTBSY;
+	}
 	inode->i_atime = CURRENT_TIME;
 	if (flag & O_TRUNC)
 		truncate(inode);
@@ -433,7 +453,7 @@ int sys_mkdir(const char * pathname, int mode)
 	de->inode = dir->i_num;
 	strcpy(de->name,"..");
 	inode->i_nlinks = 2;
-	dir_block->b_dirt = 1;
+	mark_buffer_dirty(dir_block);
 	brelse(dir_block);
 	inode->i_mode = I_DIRECTORY | (mode & 0777 & ~current->umask);
 	inode->i_dirt = 1;
@@ -446,7 +466,7 @@ int sys_mkdir(const char * pathname, int mode)
 		return -ENOSPC;
 	}
 	de->inode = inode->i_num;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	dir->i_nlinks++;
 	dir->i_dirt = 1;
 	iput(dir);
@@ -554,7 +574,7 @@ int sys_rmdir(const char * name)
 	if (inode->i_nlinks != 2)
 		printk("empty directory has nlink!=2 (%d)",inode->i_nlinks);
 	de->inode = 0;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	brelse(bh);
 	inode->i_nlinks=0;
 	inode->i_dirt=1;
@@ -608,7 +628,7 @@ int sys_unlink(const char * name)
 		inode->i_nlinks=1;
 	}
 	de->inode = 0;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	brelse(bh);
 	inode->i_nlinks--;
 	inode->i_dirt = 1;
@@ -667,7 +687,7 @@ int sys_link(const char * oldname, const char * newname)
 		return -ENOSPC;
 	}
 	de->inode = oldinode->i_num;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	brelse(bh);
 	iput(dir);
 	oldinode->i_nlinks++;
@@ -161,6 +161,9 @@ int sys_open(const char * filename,int flag,int mode)
 	f->f_count = 1;
 	f->f_inode = inode;
 	f->f_pos = 0;
+	f->f_ranext = f->f_raend = 0;
+	f->f_rawin = 0;
+	f->f_rahit = 0;
 	return (fd);
 }
 
@@ -1,5 +1,6 @@
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 
 #include <linux/kernel.h>
@@ -9,8 +10,9 @@
 extern int rw_char(int rw,int dev, char * buf, int count);
 extern int read_pipe(struct m_inode * inode, char * buf, int count);
 extern int write_pipe(struct m_inode * inode, char * buf, int count);
-extern int block_read(int dev, off_t * pos, char * buf, int count);
+extern int block_read(int dev, struct file * filp, char * buf, int count);
 extern int block_write(int dev, off_t * pos, char * buf, int count);
+extern int block_direct(int rw, int dev, off_t * pos, char * buf, int count);
 extern int file_read(struct m_inode * inode, struct file * filp,
 		char * buf, int count);
 extern int file_write(struct m_inode * inode, struct file * filp,
@@ -61,8 +63,10 @@ int sys_read(unsigned int fd,char * buf,int count)
 		return (file->f_mode&1)?read_pipe(inode,buf,count):-1;
 	if (S_ISCHR(inode->i_mode))
 		return rw_char(READ,inode->i_zone[0],buf,count);
+	if (S_ISBLK(inode->i_mode) && (file->f_flags & O_DIRECT))
+		return block_direct(READ,inode->i_zone[0],&file->f_pos,buf,count);
 	if (S_ISBLK(inode->i_mode))
-		return block_read(inode->i_zone[0],&file->f_pos,buf,count);
+		return block_read(inode->i_zone[0],file,buf,count);
 	if (S_ISDIR(inode->i_mode) || S_ISREG(inode->i_mode)) {
 		if (count+file->f_pos > inode->i_size)
 			count = inode->i_size - file->f_pos;
@@ -88,6 +92,9 @@ int sys_write(unsigned int fd,char * buf,int count)
 		return (file->f_mode&2)?write_pipe(inode,buf,count):-1;
 	if (S_ISCHR(inode->i_mode))
 		return rw_char(WRITE,inode->i_zone[0],buf,count);
+	if (S_ISBLK(inode->i_mode) && (file->f_flags & O_DIRECT))
+		return block_direct(WRITE,inode->i_zone[0],&file->f_pos,buf,
+			count);
 	if (S_ISBLK(inode->i_mode))
 		return block_write(inode->i_zone[0],&file->f_pos,buf,count);
 	if (S_ISREG(inode->i_mode))
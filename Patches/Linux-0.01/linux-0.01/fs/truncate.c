@@ -2,37 +2,54 @@
 
 #include <sys/stat.h>
 
-static void free_ind(int dev,int block)
+/* free the blocks listed in the indirect block 'bh', and release it */
+static void free_entries(int dev,struct buffer_head * bh)
 {
-	struct buffer_head * bh;
 	unsigned short * p;
 	int i;
 
+	if (!bh)
+		return;
+	p = (unsigned short *) bh->b_data;
+	for (i=0;i<512;i++,p++)
+		if (*p)
+			free_block(dev,*p);
+	brelse(bh);
+}
+
+static void free_ind(int dev,int block)
+{
 	if (!block)
 		return;
-	if (bh=bread(dev,block)) {
-		p = (unsigned short *) bh->b_data;
-		for (i=0;i<512;i++,p++)
-			if (*p)
-				free_block(dev,*p);
-		brelse(bh);
-	}
+	free_entries(dev,bread(dev,block));
 	free_block(dev,block);
 }
 
+/*
+ * The indirect blocks are read NR_MULTI at a time, so the disk doesn't
+ * have to wait for us between them.
+ */
 static void free_dind(int dev,int block)
 {
-	struct buffer_head * bh;
+	struct buffer_head * bh, * ind[NR_MULTI];
 	unsigned short * p;
-	int i;
+	int blocks[NR_MULTI];
+	int i,j,n;
 
 	if (!block)
 		return;
 	if (bh=bread(dev,block)) {
 		p = (unsigned short *) bh->b_data;
-		for (i=0;i<512;i++,p++)
-			if (*p)
-				free_ind(dev,*p);
+		for (i=0;i<512;i+=n) {
+			for (n=0;n<NR_MULTI && i+n<512;n++)
+				blocks[n] = p[i+n];
+			bread_multi(dev,blocks,ind,n);
+			for (j=0;j<n;j++)
+				if (blocks[j]) {
+					free_entries(dev,ind[j]);
+					free_block(dev,blocks[j]);
+				}
+		}
 		brelse(bh);
 	}
 	free_block(dev,block);
@@ -55,5 +72,6 @@ void truncate(struct m_inode * inode)
 	inode->i_size = 0;
 	inode->i_dirt = 1;
 	inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	invalidate_text(inode->i_dev,inode->i_num);
 }
 
@@ -17,6 +17,16 @@ __asm__ ("movl %%esp,%%eax\n\t" \
 #define cli() __asm__ ("cli"::)
 #define nop() __asm__ ("nop"::)
 
+/*
+ * For code that can be called both with interrupts on and off (from an
+ * interrupt or the timer): it turns them off, and back on only if they
+ * were on.
+ */
+#define save_flags(x) \
+__asm__ __volatile__("pushfl ; popl %0":"=r" (x)::"memory")
+#define restore_flags(x) \
+__asm__ __volatile__("pushl %0 ; popfl"::"r" (x):"memory")
+
 #define iret() __asm__ ("iret"::)
 
 #define _set_gate(gate_addr,type,dpl,addr) \
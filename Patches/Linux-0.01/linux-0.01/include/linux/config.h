@@ -17,6 +17,27 @@
 #error "must define hd"
 #endif
 
+/*
+ * RAM disk (major 1): RAMDISK kB at the top of memory, which paging then
+ * doesn't get. 0 for none. If RAMDISK_IMAGE is defined, sys_setup()
+ * fills it from the start of that device before root is mounted, so
+ * that root can be on it (define RD_ROOT).
+ */
+#define RAMDISK 0
+/* #define RAMDISK_IMAGE 0x306 */
+/* #define RD_ROOT */
+#define RAMDISK_START (HIGH_MEMORY - RAMDISK*1024)
+
+/*
+ * md (major 9) joins the devices in MD_DEVS, at most 4. MD_LEVEL 0
+ * stripes them, MD_CHUNK blocks at a time; MD_LEVEL 1 mirrors them.
+ * Define MD_ROOT to have root on it (0x900).
+ */
+/* #define MD_DEVS 0x301,0x306 */
+#define MD_LEVEL 0
+#define MD_CHUNK 8
+/* #define MD_ROOT */
+
 /* End of buffer memory. Must be 0xA0000, or > 0x100000, 4096-byte aligned */
 #if (HIGH_MEMORY>=0x600000)
 #define BUFFER_END 0x200000
@@ -24,8 +45,18 @@
 #define BUFFER_END 0xA0000
 #endif
 
-/* Root device at bootup. */
-#if	defined(LINUS_HD)
+/*
+ * Root device at bootup. Define VD_ROOT to boot from the first partition
+ * of the first virtio disk (0x801) instead.
+ */
+/* #define VD_ROOT */
+#if	defined(MD_ROOT)
+#define ROOT_DEV 0x900
+#elif	defined(RD_ROOT)
+#define ROOT_DEV 0x100
+#elif	defined(VD_ROOT)
+#define ROOT_DEV 0x801
+#elif	defined(LINUS_HD)
 #define ROOT_DEV 0x306
 #elif	defined(LASU_HD)
 #define ROOT_DEV 0x302
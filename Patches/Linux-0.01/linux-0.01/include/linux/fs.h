@@ -12,19 +12,22 @@
  * file system. These are major numbers.)
  *
  * 0 - unused (nodev)
- * 1 - /dev/mem
+ * 1 - /dev/mem (block: the RAM disk)
  * 2 - /dev/fd
  * 3 - /dev/hd
  * 4 - /dev/ttyx
  * 5 - /dev/tty
  * 6 - /dev/lp
  * 7 - unnamed pipes
+ * 8 - /dev/vd (virtio disks)
+ * 9 - /dev/md (striped or mirrored disks)
  */
 
-#define IS_BLOCKDEV(x) ((x)==2 || (x)==3)
+#define IS_BLOCKDEV(x) ((x)==1 || (x)==2 || (x)==3 || (x)==8 || (x)==9)
 
 #define READ 0
 #define WRITE 1
+#define READA 2		/* read-ahead - don't block if no resources */
 
 void buffer_init(void);
 
@@ -73,13 +76,64 @@ struct buffer_head {
                                                 //     So these blocks are required to write back into disk.
 	unsigned char b_count;		/* users using this block */
 	unsigned char b_lock;		/* 0 - ok, 1 -locked */ // XXX: We can put lock on block level.
+	unsigned char b_list;		/* lru-list the buffer is on, see below */
+	unsigned char b_ahead;		/* read ahead, and not used yet */
+	unsigned char b_hot;		/* 2Q: reused, belongs on BUF_CLEAN */
+	long b_dirtime;			/* jiffies when it got dirty */
 	struct task_struct * b_wait;
 	struct buffer_head * b_prev;
 	struct buffer_head * b_next;
-	struct buffer_head * b_prev_free;
+	struct buffer_head * b_prev_free;	/* lru-list links */
 	struct buffer_head * b_next_free;
+	struct buffer_head * b_this_page;	/* ring of buffers sharing a page */
+	void (*b_end_io)(struct buffer_head * bh);	/* see ll_rw_block() */
+	struct buffer_head * b_reqnext;	/* next buffer in the same request */
+	unsigned char b_acct;		/* counted as in flight, see iostat_done() */
+	long b_start;			/* ... since this time */
 };
 
+/*
+ * The lru-lists of the buffer cache, see refile_buffer(). A buffer in
+ * use that is neither locked nor dirty isn't on any of them, and has
+ * b_list == NR_LIST.
+ */
+#define BUF_CLEAN	0	/* clean, unlocked and unused: free for getblk */
+#define BUF_LOCKED	1	/* I/O in progress */
+#define BUF_DIRTY	2	/* waiting to be written back */
+#define BUF_NEW		3	/* like BUF_CLEAN, but used only once (2Q) */
+#define BUF_FREE	4	/* unused and empty (b_dev == 0) */
+#define NR_LIST		5
+
+struct buffer_stat {
+	unsigned long hits;		/* getblk() found the block cached */
+	unsigned long misses;		/* ... or had to take a free buffer */
+	unsigned long evictions;	/* misses that threw out a valid block */
+	unsigned long evict_writes;	/* blocks written to free a dirty buffer */
+	unsigned long flush_runs;	/* times the writeback daemon ran */
+	unsigned long flush_early;	/* ... was woken by too many dirty buffers */
+	unsigned long flush_writes;	/* blocks it wrote */
+	unsigned long ra_blocks;	/* blocks read ahead */
+	unsigned long ra_hits;		/* ... that were used */
+	unsigned long ra_misses;	/* ... that were thrown out unused */
+	unsigned long meta_hits;	/* bread(): inodes, dirs, bitmaps.. */
+	unsigned long meta_misses;
+	unsigned long data_hits;	/* breada(): file and device data */
+	unsigned long data_misses;
+	unsigned long ghost_hits;	/* 2Q: misses found in the ghost table */
+	unsigned long grow_pages;	/* pages taken from the page allocator */
+	unsigned long shrink_pages;	/* ... and given back */
+/* these are only filled in by sys_bdflush() */
+	long nr_buffers;
+	long nr_hash;
+	long nr_type[NR_LIST];
+};
+
+#define NR_BDF_PARAM 11	/* interval, age_buffer, nfract, ndirty, nap,
+				   ra_min, ra_max, policy, kin,
+				   grow_free, shrink_free */
+#define NR_AHEAD 32		/* max read-ahead window */
+#define NR_MULTI 16		/* blocks callers read with one bread_multi() */
+
 // XXX:
 //      d_inode contains the data
 //      of inode which is in disk.
@@ -155,6 +209,11 @@ struct file {
 	unsigned short f_count;
 	struct m_inode * f_inode;
 	off_t f_pos;
+/* read-ahead state, see readahead() in buffer.c */
+	long f_ranext;			/* block a sequential reader wants next */
+	long f_raend;			/* first block not read ahead */
+	unsigned short f_rawin;		/* read-ahead window, in blocks */
+	unsigned short f_rahit;		/* last block came from read-ahead */
 };
 
 /*XXX:XXX
@@ -211,6 +270,8 @@ extern struct file file_table[NR_FILE]; // XXX: file table
 extern struct super_block super_block[NR_SUPER]; // XXX: super blocks
 extern struct buffer_head * start_buffer;
 extern int nr_buffers;
+extern int nr_buffers_type[NR_LIST];
+extern struct buffer_stat buffer_stat;
 
 extern void truncate(struct m_inode * inode);
 extern void sync_inodes(void);
@@ -227,8 +288,21 @@ extern struct m_inode * get_pipe_inode(void);
 extern struct buffer_head * get_hash_table(int dev, int block);
 extern struct buffer_head * getblk(int dev, int block);
 extern void ll_rw_block(int rw, struct buffer_head * bh);
+extern void plug_blocks(void);
+extern void unplug_blocks(void);
+extern int blocks_plugged(void);
+extern struct iostat * find_iostat(int dev);
+extern void iostat_done(struct buffer_head * bh, int dir, long issued);
+extern void wait_on_buffer(struct buffer_head * bh);
 extern void brelse(struct buffer_head * buf);
+extern void refile_buffer(struct buffer_head * bh);
+extern void mark_buffer_dirty(struct buffer_head * bh);
+extern void show_buffers(void);
 extern struct buffer_head * bread(int dev,int block);
+extern struct buffer_head * breada(int dev,int block,int * ahead,int n);
+extern void bread_multi(int dev,int * block,struct buffer_head ** bh,int n);
+extern int readahead(struct file * filp,int block,int * ahead);
+extern void readahead_done(struct file * filp,struct buffer_head * bh);
 extern int new_block(int dev);
 extern void free_block(int dev, int block);
 extern struct m_inode * new_inode(int dev);
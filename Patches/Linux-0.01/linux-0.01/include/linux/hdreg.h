@@ -74,6 +74,36 @@
 #define WIN_SEEK 		0x70
 #define WIN_DIAGNOSE		0x90
 #define WIN_SPECIFY		0x91
+#define WIN_IDENTIFY		0xEC
+#define WIN_READ_EXT		0x24	/* 48-bit LBA */
+#define WIN_WRITE_EXT		0x34
+#define WIN_MULTREAD		0xC4	/* 'multiple': a block of sectors */
+#define WIN_MULTWRITE		0xC5	/* per interrupt, see WIN_SETMULT */
+#define WIN_SETMULT		0xC6
+#define WIN_MULTREAD_EXT	0x29
+#define WIN_MULTWRITE_EXT	0x39
+#define WIN_READDMA		0xC8
+#define WIN_WRITEDMA		0xCA
+#define WIN_READDMA_EXT		0x25
+#define WIN_WRITEDMA_EXT	0x35
+
+/*
+ * Bus-master IDE (PIIX and friends): registers of the primary channel,
+ * from the base in BAR 4 of the controller.
+ */
+#define BM_COMMAND	0	/* start/stop, direction */
+#define BM_STATUS	2
+#define BM_PRD		4	/* physical address of the PRD table */
+
+#define BM_START	0x01	/* BM_COMMAND */
+#define BM_TOMEM	0x08	/* ... transfer is a read from the disk */
+#define BM_ACTIVE	0x01	/* BM_STATUS */
+#define BM_ERR		0x02
+#define BM_IRQ		0x04
+#define BM_DRV0_DMA	0x20	/* drive 0 can do DMA (set by us) */
+#define BM_DRV1_DMA	0x40
+
+#define PRD_EOT		0x80000000	/* last entry of the table */
 
 /* Bits for HD_ERROR */
 #define MARK_ERR	0x01	/* Bad address mark ? */
@@ -83,6 +113,50 @@
 #define ECC_ERR		0x40	/* ? */
 #define	BBD_ERR		0x80	/* ? */
 
+/*
+ * What the request queue has done, by direction (READ/WRITE). Times are
+ * in ticks: 'wait' is from queueing to the start of the command, 'svc'
+ * from there to the end. lat_hist[] counts the requests by total time,
+ * bucket n holding those that took less than 2^n ticks, the last one
+ * all the others. iostat(buf,IOSTAT_HD) gets a copy. interrupts[] by
+ * sectors[] is what READ/WRITE MULTIPLE and DMA save: interrupts per MB
+ * are interrupts*2048/sectors.
+ */
+#define NR_LAT_HIST 12
+
+/*
+ * What hd.c can be waiting for, on the timer: the index of waits[] and
+ * wait_fails[] below, which iostat(buf,IOSTAT_HD) copies out with the
+ * timeouts and resets.
+ */
+#define WAIT_READY	0	/* controller ready for a command */
+#define WAIT_DRQ	1	/* drive asking for write data */
+#define WAIT_RESET	2	/* controller back from a reset */
+#define NR_WAIT		3
+
+struct hd_stat {
+	unsigned long requests[2];	/* requests done */
+	unsigned long sectors[2];	/* ... and the sectors they moved */
+	unsigned long merges[2];	/* buffers added to a queued request */
+	unsigned long expired[2];	/* started because their time was up */
+	unsigned long slot_waits[2];	/* submitters that slept for a request */
+	unsigned long interrupts[2];	/* read/write interrupts taken */
+	unsigned long dma_sectors[2];	/* sectors moved by bus-master DMA */
+	unsigned long wait_ticks[2];
+	unsigned long svc_ticks[2];
+	unsigned long max_wait[2];
+	unsigned long max_svc[2];
+	unsigned long lat_hist[2][NR_LAT_HIST];
+	unsigned long waits[NR_WAIT];	/* ticks waited, by reason */
+	unsigned long wait_fails[NR_WAIT]; /* ... and waits given up */
+	unsigned long timeouts;		/* interrupts that never came */
+	unsigned long resets;
+	unsigned long unexpected;	/* interrupts nobody wanted */
+	long nr_requests;		/* size of the request pool */
+};
+
+extern struct hd_stat hd_stat;
+
 struct partition {
 	unsigned char boot_ind;		/* 0x80 - active (unused) */
 	unsigned char head;		/* ? */
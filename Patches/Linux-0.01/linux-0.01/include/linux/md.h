@@ -0,0 +1,22 @@
+/*
+ * md: one block device (major 9) made of the devices in MD_DEVS, see
+ * config.h and kernel/md.c.
+ */
+#ifndef _MD_H
+#define _MD_H
+
+#define MD_MAJOR	9
+#define MD_MAX		4	/* members */
+
+/* What each member has been asked to do, see iostat(buf,IOSTAT_MD) */
+struct md_stat {
+	unsigned long reads[MD_MAX];	/* blocks */
+	unsigned long writes[MD_MAX];
+	unsigned long errors[MD_MAX];
+	unsigned long busy[MD_MAX];	/* blocks it has now */
+	unsigned long io_waits;		/* times rw_md() slept for an md_io */
+};
+
+extern struct md_stat md_stat;
+
+#endif
@@ -3,8 +3,50 @@
 
 #define PAGE_SIZE 4096
 
+extern void mem_init(void);
 extern unsigned long get_free_page(void);
+extern unsigned long get_free_pages(int order);
+extern unsigned long __get_free_page(void);
+extern unsigned long __get_free_pages(int order);
+extern void zero_idle(void);
+extern void invalidate_text(int dev, int nr);
 extern unsigned long put_page(unsigned long page,unsigned long address);
 extern void free_page(unsigned long addr);
+extern void free_pages(unsigned long addr, int order);
+
+extern int nr_free_pages;
+
+#define NR_ORDERS 6	/* get_free_pages() gives up to 2^5 pages */
+
+/*
+ * get_free_page() and get_free_pages() give cleared memory, the __
+ * versions leave it as it is, for callers that fill it anyway.
+ *
+ * Counters of the page allocator, by order. A failure is 'fragmented'
+ * if there were enough free pages, only not together. The splits and
+ * merges are the work done beyond taking a block off a list, so they
+ * say what allocating and freeing cost. iostat(buf,IOSTAT_MEM) gets a
+ * copy.
+ */
+struct page_stat {
+	unsigned long allocs[NR_ORDERS];
+	unsigned long failed[NR_ORDERS];
+	unsigned long fragmented[NR_ORDERS];
+	unsigned long free_blocks[NR_ORDERS];	/* now on the free lists */
+	unsigned long splits;
+	unsigned long merges;
+	unsigned long zero_hits;	/* get_free_page() from the zero pool */
+	unsigned long zero_misses;	/* ... and cleared on the spot */
+	unsigned long zero_filled;	/* pages the idle task cleared */
+	unsigned long zero_pool;	/* cleared pages in the pool now */
+	unsigned long text_hits;	/* text pages shared from the cache */
+	unsigned long text_misses;	/* ... and read from the disk */
+	unsigned long text_dropped;	/* thrown out as the file changed */
+};
+
+extern struct page_stat page_stat;
+
+/* in fs/buffer.c: give back up to nr pages of buffers */
+extern int shrink_buffers(int nr);
 
 #endif
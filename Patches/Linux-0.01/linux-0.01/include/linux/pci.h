@@ -0,0 +1,31 @@
+/*
+ * PCI configuration space, as far as the drivers need it to find their
+ * device and its ports. A device is named by its 'devfn', which is
+ * bus<<8 | slot<<3 | function.
+ */
+#ifndef _PCI_H
+#define _PCI_H
+
+#define PCI_VENDOR	0x00	/* vendor id, device id in the high word */
+#define PCI_COMMAND	0x04	/* command, status in the high word */
+#define PCI_CLASS	0x08	/* class.subclass.prog-if.revision */
+#define PCI_HEADER	0x0c	/* header type in bits 16-23 */
+#define PCI_BAR(n)	(0x10+4*(n))
+#define PCI_SUBSYSTEM	0x2c
+#define PCI_IRQ		0x3c	/* interrupt line in the low byte */
+
+/* Bits of PCI_COMMAND */
+#define PCI_CMD_IO	0x01
+#define PCI_CMD_MEM	0x02
+#define PCI_CMD_MASTER	0x04
+
+/* Classes (class<<8 | subclass) */
+#define PCI_CLASS_IDE	0x0101
+
+extern unsigned long pci_read(int devfn,int reg);
+extern void pci_write(int devfn,int reg,unsigned long value);
+extern int pci_find_class(int class,int from);
+extern int pci_find_device(int vendor,int device,int from);
+extern unsigned long pci_enable(int devfn,int cmd);
+
+#endif
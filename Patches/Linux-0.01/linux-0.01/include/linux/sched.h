@@ -26,7 +26,7 @@
 #endif
 
 extern int copy_page_tables(unsigned long from, unsigned long to, long size);
-extern int free_page_tables(unsigned long from, long size);
+extern int free_page_tables(unsigned long from, unsigned long size);
 
 extern void sched_init(void);
 extern void schedule(void);
@@ -96,6 +96,7 @@ struct task_struct {
 	unsigned short umask;
 	struct m_inode * pwd;
 	struct m_inode * root;
+	struct m_inode * executable;	/* pages come from here, see do_no_page() */
 	unsigned long close_on_exec;
 	struct file * filp[NR_OPEN]; //XXX: Max open files(max Fds) a process can have.
 /* ldt for this task 0 - zero 1 - cs 2 - ds&ss */
@@ -116,7 +117,7 @@ struct task_struct {
 /* uid etc */	0,0,0,0,0,0, \
 /* alarm */	0,0,0,0,0,0, \
 /* math */	0, \
-/* fs info */	-1,0133,NULL,NULL,0, \
+/* fs info */	-1,0133,NULL,NULL,NULL,0, \
 /* filp */	{NULL,}, \
 	{ \
 		{0,0}, \
@@ -142,6 +143,7 @@ extern long startup_time;
 extern void sleep_on(struct task_struct ** p);
 extern void interruptible_sleep_on(struct task_struct ** p);
 extern void wake_up(struct task_struct ** p);
+extern void add_timer(long jiffies, void (*fn)(void));
 
 /*
  * Entry into gdt where to find first TSS. 0-nul, 1-cs, 2-ds, 3-syscall
@@ -0,0 +1,82 @@
+/*
+ * Definitions for the legacy ("transitional") virtio PCI interface and
+ * its split virtqueues, as far as the virtio block driver uses them.
+ * Everything is little-endian, which is what we are anyway.
+ */
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+
+#define VIRTIO_VENDOR		0x1af4
+#define VIRTIO_BLK_DEVICE	0x1001	/* legacy id of the block device */
+
+/* Registers, from the i/o base in BAR 0 */
+#define VIRTIO_HOST_FEATURES	0	/* 32 bits */
+#define VIRTIO_GUEST_FEATURES	4	/* 32 bits */
+#define VIRTIO_QUEUE_PFN	8	/* 32 bits, page number of the ring */
+#define VIRTIO_QUEUE_SIZE	12	/* 16 bits */
+#define VIRTIO_QUEUE_SEL	14	/* 16 bits */
+#define VIRTIO_QUEUE_NOTIFY	16	/* 16 bits */
+#define VIRTIO_STATUS		18	/* 8 bits, see below */
+#define VIRTIO_ISR		19	/* 8 bits, reading it acks the irq */
+#define VIRTIO_CONFIG		20	/* device specific, without MSI-X */
+
+/* Bits of VIRTIO_STATUS */
+#define VIRTIO_ACKNOWLEDGE	1
+#define VIRTIO_DRIVER		2
+#define VIRTIO_DRIVER_OK	4
+#define VIRTIO_FAILED		128
+
+/* The block device: its config starts with the capacity in sectors */
+#define VIRTIO_BLK_CAPACITY	(VIRTIO_CONFIG+0)	/* 64 bits */
+
+#define VIRTIO_BLK_T_IN		0	/* read */
+#define VIRTIO_BLK_T_OUT	1	/* write */
+
+#define VIRTIO_BLK_S_OK		0
+
+struct virtio_blk_hdr {
+	unsigned long type;
+	unsigned long ioprio;
+	unsigned long sector;		/* 64 bits, in 512 byte sectors */
+	unsigned long sector_high;
+};
+
+/*
+ * A split virtqueue of N entries is, in memory the device can reach:
+ * the descriptors, the available ring right after them, and the used
+ * ring at the next page boundary.
+ */
+#define VRING_DESC_F_NEXT	1
+#define VRING_DESC_F_WRITE	2	/* the device writes the buffer */
+
+struct vring_desc {
+	unsigned long addr;		/* 64 bits, physical */
+	unsigned long addr_high;
+	unsigned long len;
+	unsigned short flags;
+	unsigned short next;
+};
+
+struct vring_avail {
+	unsigned short flags;
+	unsigned short idx;
+	unsigned short ring[0];
+};
+
+struct vring_used_elem {
+	unsigned long id;		/* head of the chain that is done */
+	unsigned long len;
+};
+
+struct vring_used {
+	unsigned short flags;
+	unsigned short idx;
+	struct vring_used_elem ring[0];
+};
+
+#define VRING_USED_OFFSET(n) \
+(((n)*sizeof (struct vring_desc) + 6 + 2*(n) + 4095) & ~4095)
+#define VRING_SIZE(n) \
+(VRING_USED_OFFSET(n) + 6 + (n)*sizeof (struct vring_used_elem))
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _IOSTAT_H
+#define _IOSTAT_H
+
+/*
+ * I/O statistics of one block device (major and minor), as iostat()
+ * returns them. Times are in ticks. [0] is reads, [1] writes. A block
+ * is done when the driver has finished it: queue_ticks is how long it
+ * waited in the driver's queue, svc_ticks how long the device took.
+ */
+struct iostat {
+	long dev;
+	long in_flight;			/* blocks the driver has now */
+	unsigned long ios[2];		/* blocks done */
+	unsigned long sectors[2];
+	unsigned long merges[2];	/* blocks joined to another request */
+	unsigned long seeks;		/* requests not following the last */
+	unsigned long queue_ticks[2];
+	unsigned long svc_ticks[2];
+	unsigned long busy_ticks;	/* time with anything in flight */
+	unsigned long weighted_ticks;	/* in_flight summed over time */
+	unsigned long stamp;		/* when the two above were updated */
+};
+
+#define NR_IOSTAT 32
+
+/*
+ * With one of these for n, iostat() copies the statistics of a driver
+ * to 'buf' instead, and returns 0.
+ */
+#define IOSTAT_HD	(-1)	/* struct hd_stat, <linux/hdreg.h> */
+#define IOSTAT_MD	(-2)	/* struct md_stat, <linux/md.h> */
+#define IOSTAT_MEM	(-3)	/* struct page_stat, <linux/mm.h> */
+
+extern int iostat(struct iostat * buf, int n);
+
+#endif
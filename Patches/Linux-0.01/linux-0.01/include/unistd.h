@@ -124,6 +124,8 @@
 #define __NR_getppid	64
 #define __NR_getpgrp	65
 #define __NR_setsid	66
+#define __NR_bdflush	67
+#define __NR_iostat	68
 
 #define _syscall0(type,name) \
 type name(void) \
@@ -243,5 +245,6 @@ int dup2(int oldfd, int newfd);
 int getppid(void);
 pid_t getpgrp(void);
 pid_t setsid(void);
+int bdflush(int func, long data);
 
 #endif
@@ -18,6 +18,7 @@ static inline _syscall0(int,fork)
 static inline _syscall0(int,pause)
 static inline _syscall0(int,setup)
 static inline _syscall0(int,sync)
+static inline _syscall2(int,bdflush,int,func,long,data)
 
 #include <linux/tty.h>
 #include <linux/sched.h>
@@ -38,6 +39,7 @@ static char printbuf[1024];
 extern int vsprintf();
 extern void init(void);
 extern void hd_init(void);
+extern void vd_init(void);
 extern long kernel_mktime(struct tm * tm);
 extern long startup_time;
 
@@ -82,12 +84,14 @@ void main(void)		/* This really IS void, no error here. */
  * Interrupts are still disabled. Do necessary setups, then
  * enable them
  */
+	mem_init();
 	time_init();
 	tty_init();
 	trap_init();
 	sched_init();
 	buffer_init();
 	hd_init();
+	vd_init();
 	sti();
 	move_to_user_mode();
 	if (!fork()) {		/* we count on this going ok */
@@ -122,8 +126,8 @@ void init(void)
 	int i,j;
 
 	setup();
-	if (!fork())
-		_exit(execve("/bin/update",NULL,NULL));
+	if (!fork())		/* the writeback daemon, see fs/buffer.c */
+		_exit(bdflush(0,0));
 	(void) open("/dev/tty0",O_RDWR,0);
 	(void) dup(0);
 	(void) dup(0);
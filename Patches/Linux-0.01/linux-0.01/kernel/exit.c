@@ -77,6 +77,8 @@ int do_exit(long code)
 	current->pwd=NULL;
 	iput(current->root);
 	current->root=NULL;
+	iput(current->executable);
+	current->executable=NULL;
 	if (current->leader && current->tty >= 0)
 		tty_table[current->tty].pgrp = 0;
 	if (last_task_used_math == current)
@@ -115,6 +115,8 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 		current->pwd->i_count++;
 	if (current->root)
 		current->root->i_count++;
+	if (current->executable)
+		current->executable->i_count++;
 	set_tss_desc(gdt+(nr<<1)+FIRST_TSS_ENTRY,&(p->tss));
 	set_ldt_desc(gdt+(nr<<1)+FIRST_LDT_ENTRY,&(p->ldt));
 	task[nr] = p;	/* do this last, just in case */
@@ -3,6 +3,9 @@
 #include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/hdreg.h>
+#include <linux/mm.h>
+#include <linux/pci.h>
+#include <sys/iostat.h>
 #include <asm/system.h>
 #include <asm/io.h>
 #include <asm/segment.h>
@@ -12,24 +15,76 @@
  * the hard-disk. It is relatively straigthforward (not obvious maybe,
  * but interrupts never are), while still being efficient, and never
  * disabling interrupts (except to overcome possible race-condition).
- * The elevator block-seek algorithm doesn't need to disable interrupts
- * due to clever programming.
+ * The scheduler doesn't need to disable interrupts either: the queues
+ * are only changed with 'sorting' set, and then the interrupts don't
+ * start anything new.
  */
 
 /* Max read/write errors/sector */
 #define MAX_ERRORS	5
 #define MAX_HD		2
-#define NR_REQUEST	32
+#define NR_REQUEST	32	/* requests to start with */
+#define MAX_REQUEST	512	/* ... and the most there can be */
+#define REQ_MIN_FREE	64	/* free pages needed to grow the pool */
+#define MAX_SECTORS	256	/* the most one command can move */
+
+/*
+ * Waits, in ticks. A command that gets no interrupt within HD_TIMEOUT
+ * is given up; the controller gets READY_WAIT ticks to be ready for a
+ * command, or to ask for the data of a write, and RESET_WAIT to come
+ * back from a reset. Before waiting a tick we poll SHORT_POLL times,
+ * which is usually all it takes.
+ */
+#define HD_TIMEOUT	(5*HZ)
+#define READY_WAIT	(2*HZ)
+#define RESET_WAIT	(10*HZ)
+#define SHORT_POLL	100
+
+/*
+ * The deadline scheduler: a request has to be started within
+ * READ_EXPIRE or WRITE_EXPIRE ticks of being queued. Reads come first,
+ * as processes sleep on them, but writes get their turn after
+ * WRITES_STARVED read batches. A batch is up to FIFO_BATCH requests
+ * of one direction, taken in block order.
+ */
+#define READ_EXPIRE	(HZ/2)
+#define WRITE_EXPIRE	(5*HZ)
+#define FIFO_BATCH	16
+#define WRITES_STARVED	2
 
 /*
  *  This struct defines the HD's and their types.
  *  Currently defined for CP3044's, ie a modified
- *  type 17.
+ *  type 17. identify() replaces the geometry with what the
+ *  drive says, and finds out if it can do LBA.
  */
 static struct hd_i_struct{
 	int head,sect,cyl,wpcom,lzone,ctl;
+	int lba;			/* 0 (use CHS), 28 or 48 */
+	int mult;			/* sectors per interrupt, 0 if one */
+	int dma;			/* use bus-master DMA */
+	int ident;			/* answered IDENTIFY */
+	unsigned long nr_sects;
 	} hd_info[]= { HD_TYPE };
 
+#define LBA_BIT 0x40	/* in HD_CURRENT */
+#define MAX_MULT 16	/* largest multiple mode block we set */
+
+/*
+ * Bus-master DMA: bmide is the controller's port base, 0 if there is
+ * none. A command moves its sectors straight to or from the buffers
+ * listed in prd_table, which may not cross a 64kB boundary.
+ */
+struct prd {
+	unsigned long addr;
+	unsigned long count;	/* bytes, with PRD_EOT on the last one */
+};
+
+#define NR_PRD (MAX_SECTORS/2+1)
+
+static int bmide = 0;
+static struct prd prd_table[NR_PRD] __attribute__ ((aligned (2048)));
+
 #define NR_HD ((sizeof (hd_info))/(sizeof (struct hd_i_struct)))
 
 static struct hd_struct {
@@ -37,33 +92,77 @@ static struct hd_struct {
 	long nr_sects;
 } hd[5*MAX_HD]={{0,0},};
 
+/*
+ * A request is a run of sectors on one drive, counted from the start of
+ * the drive, and the buffers (linked by b_reqnext, 2 sectors each) they
+ * go to or come from. 'sector' and 'nsector' are what is left to do, so
+ * nsector&1 tells which half of the first buffer is next.
+ *
+ * Requests wait on fifo[READ] or fifo[WRITE], oldest first, until
+ * pick_request() makes one this_request.
+ */
 static struct hd_request {
 	int hd;		/* -1 if no request */
 	int nsector;
 	int sector;
-	int head;
-	int cyl;
 	int cmd;
 	int errors;
+	long start;	/* jiffies when queued */
+	long expires;	/* ... and when it should be started by */
+	long issued;	/* ... and when it was */
 	struct buffer_head * bh;
+	struct buffer_head * bhtail;
 	struct hd_request * next;
 } request[NR_REQUEST];
 
 #define IN_ORDER(s1,s2) \
 ((s1)->hd<(s2)->hd || (s1)->hd==(s2)->hd && \
-((s1)->cyl<(s2)->cyl || (s1)->cyl==(s2)->cyl && \
-((s1)->head<(s2)->head || (s1)->head==(s2)->head && \
-((s1)->sector<(s2)->sector))))
+(s1)->sector<(s2)->sector)
+
+#define DIR(req) ((req)->cmd == WIN_WRITE)
 
 static struct hd_request * this_request = NULL;
+static struct hd_request * fifo[2] = {NULL,NULL};
+
+/*
+ * Free requests are on free_requests. When there are none, a submitter
+ * waits in line on read_waiters or write_waiters, and free_request()
+ * gives the next free request to the first one in line and wakes only
+ * that one. Reads are served first, and writes may never hold more
+ * than 3/4 of the pool, so there are always requests left for reads.
+ */
+struct req_wait {
+	struct task_struct * task;
+	struct hd_request * req;
+	struct req_wait * next;
+};
+
+static struct hd_request * free_requests = NULL;
+static struct req_wait * read_waiters = NULL;
+static struct req_wait * write_waiters = NULL;
+static int nr_requests = 0;
+static int nr_write_requests = 0;
+
+#define write_limit() (nr_requests - (nr_requests>>2))
+
+static int last_hd = 0, last_sector = 0;	/* where the heads are going */
+static int batch_dir = READ, batch_left = 0;
+static int starved = 0;
+
+struct hd_stat hd_stat = {{0,},};
 
 static int sorting=0;
 
 static void do_request(void);
-static void reset_controller(void);
-static void rw_abs_hd(int rw,unsigned int nr,unsigned int sec,unsigned int head,
-	unsigned int cyl,struct buffer_head * bh);
+static void reset_hd(int nr);
+static void bad_rw_intr(void);
+static void end_request(int uptodate);
+void unplug_hd(void);
+static void rw_abs_hd(int rw,unsigned int nr,unsigned int sector,
+	struct buffer_head * bh);
 void hd_init(void);
+extern void vd_setup(void);
+extern void rd_load(void);
 
 #define port_read(port,buf,nr) \
 __asm__("cld;rep;insw"::"d" (port),"D" (buf),"c" (nr):"cx","di")
@@ -73,13 +172,13 @@ __asm__("cld;rep;outsw"::"d" (port),"S" (buf),"c" (nr):"cx","si")
 
 extern void hd_interrupt(void);
 
-static struct task_struct * wait_for_request=NULL;
 
 static inline void lock_buffer(struct buffer_head * bh)
 {
 	if (bh->b_lock)
 		printk("hd.c: buffer multiply locked\n");
 	bh->b_lock=1;
+	refile_buffer(bh);
 }
 
 static inline void unlock_buffer(struct buffer_head * bh)
@@ -87,33 +186,20 @@ static inline void unlock_buffer(struct buffer_head * bh)
 	if (!bh->b_lock)
 		printk("hd.c: free buffer being unlocked\n");
 	bh->b_lock=0;
+	refile_buffer(bh);
 	wake_up(&bh->b_wait);
 }
 
-static inline void wait_on_buffer(struct buffer_head * bh)
-{
-	cli();
-	while (bh->b_lock)
-		sleep_on(&bh->b_wait);
-	sti();
-}
-
 void rw_hd(int rw, struct buffer_head * bh)
 {
 	unsigned int block,dev;
-	unsigned int sec,head,cyl;
 
 	block = bh->b_blocknr << 1;
 	dev = MINOR(bh->b_dev);
 	if (dev >= 5*NR_HD || block+2 > hd[dev].nr_sects)
 		return;
 	block += hd[dev].start_sect;
-	dev /= 5;
-	__asm__("divl %4":"=a" (block),"=d" (sec):"0" (block),"1" (0),
-		"r" (hd_info[dev].sect));
-	__asm__("divl %4":"=a" (cyl),"=d" (head):"0" (block),"1" (0),
-		"r" (hd_info[dev].head));
-	rw_abs_hd(rw,dev,sec+1,head,cyl,bh);
+	rw_abs_hd(rw,dev/5,block,bh);
 }
 
 /* This may be used only once, enforced by 'static int callable' */
@@ -127,7 +213,10 @@ int sys_setup(void)
 		return -1;
 	callable = 0;
 	for (drive=0 ; drive<NR_HD ; drive++) {
-		rw_abs_hd(READ,drive,1,0,0,(struct buffer_head *) start_buffer);
+		if (!hd_info[drive].ident && MAJOR(ROOT_DEV) != 3)
+			continue;	/* probably not there: don't panic */
+		rw_abs_hd(READ,drive,0,(struct buffer_head *) start_buffer);
+		wait_on_buffer(start_buffer);
 		if (!start_buffer->b_uptodate) {
 			printk("Unable to read partition table of drive %d\n\r",
 				drive);
@@ -145,6 +234,8 @@ int sys_setup(void)
 		}
 	}
 	printk("Partition table%s ok.\n\r",(NR_HD>1)?"s":"");
+	vd_setup();
+	rd_load();
 	mount_root();
 	return (0);
 }
@@ -152,15 +243,78 @@ int sys_setup(void)
 /*
  * This is the pointer to a routine to be executed at every hd-interrupt.
  * Interesting way of doing things, but should be rather practical.
+ * hd_interrupt clears it before calling it, so a routine that wants the
+ * next interrupt too has to set_intr() itself again. It is an interrupt
+ * gate: the timer mustn't see do_hd cleared while the routine is still
+ * finishing the request or starting the next one.
  */
 void (*do_hd)(void) = NULL;
 
-static int controller_ready(void)
+static long hd_timeout = 0;	/* when the interrupt should have come */
+static int watchdog = 0;	/* hd_watchdog() is on the timer list */
+
+static void hd_watchdog(void);
+
+static void set_intr(void (*fn)(void))
 {
-	int retries=1000;
+	do_hd = fn;
+	hd_timeout = jiffies + HD_TIMEOUT;
+	if (!watchdog) {
+		watchdog = 1;
+		add_timer(HD_TIMEOUT,&hd_watchdog);
+	}
+}
 
-	while (--retries && (inb(HD_STATUS)&0xc0)!=0x40);
-	return (retries);
+static int hd_poll(int mask, int want)
+{
+	int i;
+
+	for (i = 0 ; i < SHORT_POLL ; i++)
+		if ((inb_p(HD_STATUS) & mask) == want)
+			return 1;
+	return 0;
+}
+
+#define controller_ready() hd_poll(BUSY_STAT|READY_STAT,READY_STAT)
+
+/*
+ * When the controller isn't ready yet, we don't spin: hd_wait() has the
+ * timer call 'fn' again on the next tick. Meanwhile do_hd is wait_intr,
+ * so the driver counts as busy and add_request() leaves it alone. When
+ * the wait has gone on for 'limit' ticks, hd_wait() returns 0 and the
+ * caller has to do something about it. Like the interrupt, the timer
+ * calls 'fn' with interrupts off, and nothing it calls turns them on.
+ */
+static void (*wait_fn)(void) = NULL;
+static int wait_ticks = 0;
+
+static void wait_intr(void)
+{
+	do_hd = &wait_intr;
+}
+
+static void hd_retry(void)
+{
+	void (*fn)(void) = wait_fn;
+
+	wait_fn = NULL;
+	do_hd = NULL;
+	if (fn)
+		fn();
+}
+
+static int hd_wait(void (*fn)(void), int why, int limit)
+{
+	if (wait_ticks++ >= limit) {
+		wait_ticks = 0;
+		hd_stat.wait_fails[why]++;
+		return 0;
+	}
+	hd_stat.waits[why]++;
+	wait_fn = fn;
+	do_hd = &wait_intr;
+	add_timer(1,&hd_retry);
+	return 1;
 }
 
 static int win_result(void)
@@ -180,11 +334,12 @@ static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sect,
 {
 	register int port asm("dx");
 
-	if (drive>1 || head>15)
+	if (drive>1 || (head & ~(LBA_BIT|15)))
 		panic("Trying to write bad sector");
 	if (!controller_ready())
 		panic("HD controller not ready");
-	do_hd = intr_addr;
+	wait_ticks = 0;
+	set_intr(intr_addr);
 	outb(_CTL,HD_CMD);
 	port=HD_DATA;
 	outb_p(_WPCOM,++port);
@@ -196,218 +351,832 @@ static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sect,
 	outb(cmd,++port);
 }
 
-static int drive_busy(void)
+/*
+ * ext_cmd() is the 48-bit form of a read or write command.
+ */
+static unsigned int ext_cmd(unsigned int cmd)
+{
+	switch (cmd) {
+		case WIN_READ: return WIN_READ_EXT;
+		case WIN_WRITE: return WIN_WRITE_EXT;
+		case WIN_MULTREAD: return WIN_MULTREAD_EXT;
+		case WIN_MULTWRITE: return WIN_MULTWRITE_EXT;
+		case WIN_READDMA: return WIN_READDMA_EXT;
+		case WIN_WRITEDMA: return WIN_WRITEDMA_EXT;
+	}
+	panic("hd: no 48-bit form of command");
+}
+
+/*
+ * hd_out_block() starts 'cmd' (a read or write, by PIO, multiple or DMA)
+ * on nsect sectors from 'block', counted from the start of the drive. Drives that can do
+ * LBA get the block as it is, the 48-bit commands being used only for
+ * blocks out of reach of the 28-bit ones. Only old drives still need it
+ * turned into cylinder, head and sector.
+ */
+static void hd_out_block(unsigned int drive,unsigned int nsect,
+		unsigned int block,unsigned int cmd,void (*intr_addr)(void))
 {
-	unsigned int i;
+	unsigned int sec,head,cyl;
 
-	for (i = 0; i < 100000; i++)
-		if (READY_STAT == (inb(HD_STATUS) & (BUSY_STAT | READY_STAT)))
-			break;
-	i = inb(HD_STATUS);
-	i &= BUSY_STAT | READY_STAT | SEEK_STAT;
-	if (i == READY_STAT | SEEK_STAT)
-		return(0);
-	printk("HD controller times out\n\r");
-	return(1);
+	if (hd_info[drive].lba == 48 && block+nsect > 0x0fffffff) {
+		if (!controller_ready())
+			panic("HD controller not ready");
+		wait_ticks = 0;
+		set_intr(intr_addr);
+		outb(_CTL,HD_CMD);
+		outb_p(nsect>>8,HD_NSECTOR);	/* high order bytes first */
+		outb_p(block>>24,HD_SECTOR);
+		outb_p(0,HD_LCYL);
+		outb_p(0,HD_HCYL);
+		outb_p(nsect,HD_NSECTOR);
+		outb_p(block,HD_SECTOR);
+		outb_p(block>>8,HD_LCYL);
+		outb_p(block>>16,HD_HCYL);
+		outb_p(0xA0|LBA_BIT|(drive<<4),HD_CURRENT);
+		outb(ext_cmd(cmd),HD_COMMAND);
+		return;
+	}
+	if (hd_info[drive].lba) {
+		hd_out(drive,nsect,block & 0xff,LBA_BIT|((block>>24) & 15),
+			(block>>8) & 0xffff,cmd,intr_addr);
+		return;
+	}
+	__asm__("divl %4":"=a" (block),"=d" (sec):"0" (block),"1" (0),
+		"r" (hd_info[drive].sect));
+	__asm__("divl %4":"=a" (cyl),"=d" (head):"0" (block),"1" (0),
+		"r" (hd_info[drive].head));
+	hd_out(drive,nsect,sec+1,head,cyl,cmd,intr_addr);
 }
 
-static void reset_controller(void)
+static int reset_drive = 0;
+
+/*
+ * mult_intr() ends the SET MULTIPLE that reset_hd() sends after the
+ * SPECIFY. If the drive won't take it any more, we do without.
+ */
+static void mult_intr(void)
 {
-	int	i;
+	if (win_result()) {
+		printk("hd%d: multiple mode off\n\r",reset_drive);
+		hd_info[reset_drive].mult = 0;
+	}
+	do_request();
+}
+
+static void specify_intr(void)
+{
+	win_result();
+	hd_out(reset_drive,hd_info[reset_drive].mult,0,0,0,
+		WIN_SETMULT,&mult_intr);
+}
+
+/*
+ * A reset goes in steps, a tick or more apart: reset_hd() sets SRST,
+ * end_reset() takes it away, and reset_ready() waits for the drive to
+ * come back and gives it its geometry again.
+ */
+static void reset_ready(void)
+{
+	int i;
 
-	outb(4,HD_CMD);
-	for(i = 0; i < 1000; i++) nop();
-	outb(0,HD_CMD);
-	for(i = 0; i < 10000 && drive_busy(); i++) /* nothing */;
-	if (drive_busy())
+	if (!controller_ready()) {
+		if (hd_wait(&reset_ready,WAIT_RESET,RESET_WAIT))
+			return;
 		printk("HD-controller still busy\n\r");
-	if((i = inb(ERR_STAT)) != 1)
+		if (this_request)
+			end_request(0);
+		do_request();
+		return;
+	}
+	if ((i = inb(HD_ERROR)) != 1)
 		printk("HD-controller reset failed: %02x\n\r",i);
+	hd_out(reset_drive,hd_info[reset_drive].sect,hd_info[reset_drive].sect,
+		hd_info[reset_drive].head-1,hd_info[reset_drive].cyl,WIN_SPECIFY,
+		hd_info[reset_drive].mult ? &specify_intr : &do_request);
+}
+
+static void end_reset(void)
+{
+	outb(_CTL,HD_CMD);
+	wait_ticks = 0;
+	reset_ready();
 }
 
 static void reset_hd(int nr)
 {
-	reset_controller();
-	hd_out(nr,_SECT,_SECT,_HEAD-1,_CYL,WIN_SPECIFY,&do_request);
+	if (bmide)
+		outb(0,bmide+BM_COMMAND);
+	hd_stat.resets++;
+	reset_drive = nr;
+	outb(4|_CTL,HD_CMD);
+	wait_ticks = 0;
+	hd_wait(&end_reset,WAIT_RESET,RESET_WAIT);
+}
+
+/*
+ * hd_watchdog() runs from the timer when a command may have had its
+ * time. If it has, and still no interrupt came, the request is retried
+ * after a reset, as for an error. An interrupt that comes after all
+ * is then unexpected, which is harmless.
+ */
+static void hd_watchdog(void)
+{
+	watchdog = 0;
+	if (!do_hd || do_hd == &wait_intr)
+		return;
+	if ((long) (jiffies - hd_timeout) < 0) {
+		watchdog = 1;
+		add_timer(hd_timeout - jiffies,&hd_watchdog);
+		return;
+	}
+	hd_stat.timeouts++;
+	printk("HD controller times out\n\r");
+	do_hd = NULL;
+	if (bmide)
+		outb(0,bmide+BM_COMMAND);
+	if (this_request)
+		bad_rw_intr();
+	else
+		reset_hd(reset_drive);
 }
 
 void unexpected_hd_interrupt(void)
 {
-	panic("Unexpected HD interrupt\n\r");
+	hd_stat.unexpected++;
+	inb_p(HD_STATUS);	/* acknowledge it */
+}
+
+static void add_free_request(struct hd_request * req)
+{
+	req->hd = -1;
+	req->next = free_requests;
+	free_requests = req;
+	hd_stat.nr_requests = ++nr_requests;
+}
+
+/*
+ * free_request() is called from the interrupt when a request is done.
+ */
+static void free_request(struct hd_request * req)
+{
+	struct req_wait * w;
+
+	if (DIR(req))
+		nr_write_requests--;
+	req->hd = -1;
+	if ((w = read_waiters) != NULL)
+		read_waiters = w->next;
+	else if ((w = write_waiters) && nr_write_requests < write_limit()) {
+		write_waiters = w->next;
+		nr_write_requests++;
+	} else {
+		req->next = free_requests;
+		free_requests = req;
+		return;
+	}
+	w->req = req;
+	wake_up(&w->task);
+}
+
+/*
+ * The pool starts with the NR_REQUEST static requests, and grows a page
+ * at a time when they are all in use, as long as memory isn't short.
+ */
+static int grow_requests(void)
+{
+	struct hd_request * req;
+	unsigned long page;
+	int i;
+
+	if (nr_requests >= MAX_REQUEST || nr_free_pages < REQ_MIN_FREE)
+		return 0;
+	if (!(page = get_free_page()))
+		return 0;
+	req = (struct hd_request *) page;
+	cli();
+	for (i = PAGE_SIZE/sizeof (struct hd_request) ; i-- > 0 ; req++)
+		add_free_request(req);
+	sti();
+	return 1;
+}
+
+/*
+ * get_request() takes a free request, in O(1). If there are none, or
+ * writes have all they may have, it waits its turn - READA doesn't, and
+ * gets NULL.
+ */
+static struct hd_request * get_request(int rw)
+{
+	struct req_wait wait, ** p;
+	struct hd_request * req;
+
+	p = (rw == WRITE) ? &write_waiters : &read_waiters;
+repeat:
+	cli();
+	if (!*p && (req = free_requests) &&
+	    (rw != WRITE || nr_write_requests < write_limit())) {
+		free_requests = req->next;
+		if (rw == WRITE)
+			nr_write_requests++;
+		sti();
+		return req;
+	}
+	sti();
+	if (!*p && !free_requests && grow_requests())
+		goto repeat;
+	if (rw == READA)
+		return NULL;
+	hd_stat.slot_waits[rw]++;
+	unplug_hd();		/* or the slots may never come free */
+	wait.task = NULL;
+	wait.req = NULL;
+	wait.next = NULL;
+	cli();
+	while (*p)
+		p = &(*p)->next;
+	*p = &wait;
+	while (!wait.req)
+		sleep_on(&wait.task);
+	sti();
+	return wait.req;
+}
+
+/*
+ * end_buffer() finishes the first buffer of this_request: it is unlocked
+ * and its b_end_io called.
+ */
+static void end_buffer(int uptodate)
+{
+	struct buffer_head * bh = this_request->bh;
+	void (*end_io)(struct buffer_head *);
+
+	this_request->bh = bh->b_reqnext;
+	bh->b_reqnext = NULL;
+	iostat_done(bh,DIR(this_request),this_request->issued);
+	bh->b_uptodate = uptodate;
+	if (uptodate)
+		bh->b_dirt = 0;
+	end_io = bh->b_end_io;
+	bh->b_end_io = NULL;
+	unlock_buffer(bh);
+	if (end_io)
+		end_io(bh);
+}
+
+/*
+ * end_request() finishes the buffers this_request has left, and gives
+ * the request slot back.
+ */
+static void end_request(int uptodate)
+{
+	struct hd_request * req = this_request;
+	unsigned long wait, svc, total;
+	int dir = DIR(req), i;
+
+	while (req->bh)
+		end_buffer(uptodate);
+	wait = req->issued - req->start;
+	svc = jiffies - req->issued;
+	hd_stat.requests[dir]++;
+	hd_stat.wait_ticks[dir] += wait;
+	hd_stat.svc_ticks[dir] += svc;
+	if (wait > hd_stat.max_wait[dir])
+		hd_stat.max_wait[dir] = wait;
+	if (svc > hd_stat.max_svc[dir])
+		hd_stat.max_svc[dir] = svc;
+	total = wait + svc;
+	for (i = 0 ; i < NR_LAT_HIST-1 && total >= (1UL << i) ; i++)
+		/* nothing */ ;
+	hd_stat.lat_hist[dir][i]++;
+	this_request = NULL;
+	free_request(req);
 }
 
+/*
+ * A drive that keeps failing with DMA is put back to PIO, and one that
+ * keeps failing in multiple mode to a sector per interrupt, before we
+ * give up on the request.
+ */
 static void bad_rw_intr(void)
 {
 	int i = this_request->hd;
 
-	if (this_request->errors++ >= MAX_ERRORS) {
-		this_request->bh->b_uptodate = 0;
-		unlock_buffer(this_request->bh);
-		wake_up(&wait_for_request);
-		this_request->hd = -1;
-		this_request=this_request->next;
+	if (hd_info[i].dma && this_request->errors >= MAX_ERRORS/2) {
+		printk("hd%d: DMA off\n\r",i);
+		hd_info[i].dma = 0;
+	} else if (hd_info[i].mult && this_request->errors >= MAX_ERRORS/2) {
+		printk("hd%d: multiple mode off\n\r",i);
+		hd_info[i].mult = 0;
 	}
+	if (this_request->errors++ >= MAX_ERRORS)
+		end_request(0);
 	reset_hd(i);
 }
 
+/*
+ * chunk() is the number of sectors the drive moves before its next
+ * interrupt: one, or in multiple mode a block of 'mult' of them, the
+ * last block of a command being what is left.
+ */
+static int chunk(struct hd_request * req)
+{
+	int n = hd_info[req->hd].mult;
+
+	if (!n)
+		return 1;
+	return (n < req->nsector) ? n : req->nsector;
+}
+
+/*
+ * done_sectors() moves this_request on by n sectors, finishing the
+ * buffers that are done.
+ */
+static void done_sectors(int n)
+{
+	this_request->errors = 0;
+	this_request->sector += n;
+	while (n--)
+		if (!(--this_request->nsector & 1))
+			end_buffer(1);
+}
+
+/*
+ * write_sectors() gives the drive the next n sectors of this_request.
+ * They may go on over several buffers, which are finished only when the
+ * interrupt says they're written.
+ */
+static void write_sectors(int n)
+{
+	struct buffer_head * bh = this_request->bh;
+	int nsect = this_request->nsector;
+
+	while (n--) {
+		port_write(HD_DATA,bh->b_data+512*(nsect&1),256);
+		if (!(--nsect & 1))
+			bh = bh->b_reqnext;
+	}
+}
+
 static void read_intr(void)
 {
+	int n;
+
+	hd_stat.interrupts[READ]++;
 	if (win_result()) {
 		bad_rw_intr();
 		return;
 	}
-	port_read(HD_DATA,this_request->bh->b_data+
-		512*(this_request->nsector&1),256);
-	this_request->errors = 0;
-	if (--this_request->nsector)
+	set_intr(&read_intr);
+	n = chunk(this_request);
+	while (n--) {
+		port_read(HD_DATA,this_request->bh->b_data+
+			512*(this_request->nsector&1),256);
+		done_sectors(1);
+	}
+	if (this_request->nsector)
 		return;
-	this_request->bh->b_uptodate = 1;
-	this_request->bh->b_dirt = 0;
-	wake_up(&wait_for_request);
-	unlock_buffer(this_request->bh);
-	this_request->hd = -1;
-	this_request=this_request->next;
+	end_request(1);
 	do_request();
 }
 
 static void write_intr(void)
 {
+	hd_stat.interrupts[WRITE]++;
 	if (win_result()) {
 		bad_rw_intr();
 		return;
 	}
-	if (--this_request->nsector) {
-		port_write(HD_DATA,this_request->bh->b_data+512,256);
+	done_sectors(chunk(this_request));
+	if (this_request->nsector) {
+		set_intr(&write_intr);
+		write_sectors(chunk(this_request));
 		return;
 	}
-	this_request->bh->b_uptodate = 1;
-	this_request->bh->b_dirt = 0;
-	wake_up(&wait_for_request);
-	unlock_buffer(this_request->bh);
-	this_request->hd = -1;
-	this_request=this_request->next;
+	end_request(1);
 	do_request();
 }
 
-static void do_request(void)
+/*
+ * start_write() gives the drive the first sectors of a write, once it
+ * asks for them.
+ */
+static void start_write(void)
 {
-	int i,r;
+	if (!hd_poll(BUSY_STAT|DRQ_STAT,DRQ_STAT)) {
+		if (!hd_wait(&start_write,WAIT_DRQ,READY_WAIT))
+			bad_rw_intr();
+		return;
+	}
+	wait_ticks = 0;
+	set_intr(&write_intr);
+	write_sectors(chunk(this_request));
+}
 
-	if (sorting)
+/*
+ * setup_dma() fills prd_table with the buffers of this_request, joining
+ * those that follow each other in memory, and gets the controller ready
+ * to go in the right direction.
+ */
+static void setup_dma(void)
+{
+	struct buffer_head * bh = this_request->bh;
+	struct prd * p = prd_table;
+	unsigned long addr;
+	int nsect = this_request->nsector, n;
+
+	while (nsect) {
+		n = (nsect & 1) ? 1 : 2;
+		addr = (unsigned long) bh->b_data + 512*(nsect & 1);
+		if (p > prd_table && p[-1].addr + p[-1].count == addr &&
+		    p[-1].count + 512*n < 0x10000 &&
+		    !((p[-1].addr ^ (addr + 512*n - 1)) & ~0xffff))
+			p[-1].count += 512*n;
+		else {
+			p->addr = addr;
+			p->count = 512*n;
+			p++;
+		}
+		nsect -= n;
+		bh = bh->b_reqnext;
+	}
+	p[-1].count |= PRD_EOT;
+	outl((unsigned long) prd_table,bmide+BM_PRD);
+	outb(inb(bmide+BM_STATUS) | BM_IRQ | BM_ERR,bmide+BM_STATUS);
+	outb(DIR(this_request) ? 0 : BM_TOMEM,bmide+BM_COMMAND);
+}
+
+/*
+ * dma_intr() ends a DMA command: the whole request is done in one go.
+ */
+static void dma_intr(void)
+{
+	int st;
+
+	outb(0,bmide+BM_COMMAND);
+	st = inb(bmide+BM_STATUS);
+	outb(st,bmide+BM_STATUS);	/* clears BM_IRQ and BM_ERR */
+	hd_stat.interrupts[DIR(this_request)]++;
+	if (win_result() || (st & BM_ERR)) {
+		bad_rw_intr();
 		return;
-	if (!this_request) {
+	}
+	hd_stat.dma_sectors[DIR(this_request)] += this_request->nsector;
+	done_sectors(this_request->nsector);
+	end_request(1);
+	do_request();
+}
+
+static void unlink_request(struct hd_request * req)
+{
+	struct hd_request ** p = &fifo[DIR(req)];
+
+	while (*p != req)
+		p = &(*p)->next;
+	*p = req->next;
+	req->next = NULL;
+}
+
+/*
+ * next_in_order() is the elevator: the queued request of direction 'dir'
+ * that comes first after the last one started, going up the disk, or
+ * the lowest one when there are none above.
+ */
+static struct hd_request * next_in_order(int dir)
+{
+	struct hd_request * req, * up = NULL, * low = NULL;
+	struct hd_request pos;
+
+	pos.hd = last_hd;
+	pos.sector = last_sector;
+	for (req = fifo[dir] ; req ; req = req->next) {
+		if (!low || IN_ORDER(req,low))
+			low = req;
+		if (!IN_ORDER(req,&pos) && (!up || IN_ORDER(req,up)))
+			up = req;
+	}
+	return up ? up : low;
+}
+
+#define expired(req) ((req) && (long) (jiffies - (req)->expires) >= 0)
+
+/*
+ * pick_request() chooses the next request to start. A batch goes on in
+ * block order - unless reads are waiting past their time behind a write
+ * batch. A new batch is reads, if there are any and writes haven't been
+ * passed over too often, and starts with the oldest request if that one
+ * has expired, else where the heads are.
+ */
+static struct hd_request * pick_request(void)
+{
+	struct hd_request * req;
+	int dir;
+
+	if (batch_left > 0 && fifo[batch_dir] &&
+	    !(batch_dir == WRITE && expired(fifo[READ]))) {
+		batch_left--;
+		req = next_in_order(batch_dir);
+	} else {
+		if (fifo[READ] && !(fifo[WRITE] && starved >= WRITES_STARVED)) {
+			dir = READ;
+			if (fifo[WRITE])
+				starved++;
+		} else if (fifo[WRITE]) {
+			dir = WRITE;
+			starved = 0;
+		} else
+			return NULL;
+		if (expired(fifo[dir])) {
+			req = fifo[dir];
+			hd_stat.expired[dir]++;
+		} else
+			req = next_in_order(dir);
+		batch_dir = dir;
+		batch_left = FIFO_BATCH-1;
+	}
+	unlink_request(req);
+	req->issued = jiffies;
+	hd_stat.sectors[DIR(req)] += req->nsector;
+	if (req->hd != last_hd || req->sector != last_sector)
+		find_iostat(req->bh->b_dev)->seeks++;
+	last_hd = req->hd;
+	last_sector = req->sector + req->nsector;
+	return req;
+}
+
+/*
+ * do_request() starts this_request at the sector it has got to, or picks
+ * a new one. If the queue is being changed it does nothing, and clears
+ * do_hd so that add_request() knows to start it again.
+ */
+static void do_request(void)
+{
+	if (sorting || (!this_request && !(this_request = pick_request()))) {
 		do_hd=NULL;
 		return;
 	}
+	if (!controller_ready()) {
+		if (!hd_wait(&do_request,WAIT_READY,READY_WAIT))
+			bad_rw_intr();
+		return;
+	}
+	if (hd_info[this_request->hd].dma) {
+		setup_dma();
+		hd_out_block(this_request->hd,this_request->nsector,
+			this_request->sector,DIR(this_request) ? WIN_WRITEDMA :
+			WIN_READDMA,&dma_intr);
+		outb(BM_START | (DIR(this_request) ? 0 : BM_TOMEM),
+			bmide+BM_COMMAND);
+		return;
+	}
 	if (this_request->cmd == WIN_WRITE) {
-		hd_out(this_request->hd,this_request->nsector,this_request->
-			sector,this_request->head,this_request->cyl,
-			this_request->cmd,&write_intr);
-		for(i=0 ; i<3000 && !(r=inb_p(HD_STATUS)&DRQ_STAT) ; i++)
-			/* nothing */ ;
-		if (!r) {
-			reset_hd(this_request->hd);
-			return;
-		}
-		port_write(HD_DATA,this_request->bh->b_data+
-			512*(this_request->nsector&1),256);
+		hd_out_block(this_request->hd,this_request->nsector,
+			this_request->sector,hd_info[this_request->hd].mult ?
+			WIN_MULTWRITE : WIN_WRITE,&write_intr);
+		start_write();
 	} else if (this_request->cmd == WIN_READ) {
-		hd_out(this_request->hd,this_request->nsector,this_request->
-			sector,this_request->head,this_request->cyl,
-			this_request->cmd,&read_intr);
+		hd_out_block(this_request->hd,this_request->nsector,
+			this_request->sector,hd_info[this_request->hd].mult ?
+			WIN_MULTREAD : WIN_READ,&read_intr);
 	} else
 		panic("unknown hd-command");
 }
 
 /*
- * add-request adds a request to the linked list.
+ * add-request puts a request at the end of its fifo.
  * It sets the 'sorting'-variable when doing something
  * that interrupts shouldn't touch.
  */
 static void add_request(struct hd_request * req)
 {
-	struct hd_request * tmp;
+	struct hd_request ** p = &fifo[DIR(req)];
 
-	if (req->nsector != 2)
-		panic("nsector!=2 not implemented");
-/*
- * Not to mess up the linked lists, we never touch the two first
- * entries (not this_request, as it is used by current interrups,
- * and not this_request->next, as it can be assigned to this_request).
- * This is not too high a price to pay for the ability of not
- * disabling interrupts.
- */
+	req->start = jiffies;
+	req->expires = jiffies + (DIR(req) ? WRITE_EXPIRE : READ_EXPIRE);
 	sorting=1;
-	if (!(tmp=this_request))
-		this_request=req;
-	else {
-		if (!(tmp->next))
-			tmp->next=req;
-		else {
-			tmp=tmp->next;
-			for ( ; tmp->next ; tmp=tmp->next)
-				if ((IN_ORDER(tmp,req) ||
-				    !IN_ORDER(tmp,tmp->next)) &&
-				    IN_ORDER(req,tmp->next))
-					break;
-			req->next=tmp->next;
-			tmp->next=req;
-		}
-	}
+	while (*p)
+		p = &(*p)->next;
+	*p = req;
 	sorting=0;
 /*
  * NOTE! As a result of sorting, the interrupts may have died down,
  * as they aren't redone due to locking with sorting=1. They might
  * also never have started, if this is the first request in the queue,
- * so we restart them if necessary.
+ * so we restart them if necessary - unless the submitter has more
+ * coming, see plug_blocks().
+ */
+	if (!blocks_plugged())
+		unplug_hd();
+}
+
+/*
+ * unplug_hd() starts the queue if the drive is idle. The plug timer
+ * calls it too, so the check and the start must not be split by it -
+ * and as it runs with interrupts off, it mustn't turn them on. The
+ * timer can't come in while hd_interrupt is at work (it is an interrupt
+ * gate), so an idle do_hd here really means an idle drive.
  */
+void unplug_hd(void)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
 	if (!do_hd)
 		do_request();
+	restore_flags(flags);
+}
+
+/*
+ * merge_request() tries to add 'bh' to a request that is already queued:
+ * at its end if the buffer follows it on the disk, or in front if it
+ * comes just before it. The request keeps its place in the fifo, and
+ * its deadline. this_request isn't on the fifos, so the interrupts never
+ * see a request change under them. Returns 1 if it could.
+ */
+static int merge_request(int cmd,unsigned int nr,unsigned int sector,
+	struct buffer_head * bh)
+{
+	struct hd_request * req;
+
+	sorting=1;
+	for (req = fifo[cmd == WIN_WRITE] ; req ; req = req->next) {
+		if (req->hd != nr || req->nsector+2 > MAX_SECTORS)
+			continue;
+		if (req->sector+req->nsector == sector) {
+			req->bhtail->b_reqnext = bh;
+			req->bhtail = bh;
+			req->nsector += 2;
+			break;
+		}
+		if (sector+2 == req->sector) {
+			bh->b_reqnext = req->bh;
+			req->bh = bh;
+			req->sector = sector;
+			req->nsector += 2;
+			break;
+		}
+	}
+	if (req) {
+		hd_stat.merges[DIR(req)]++;
+		find_iostat(bh->b_dev)->merges[DIR(req)]++;
+	}
+	sorting=0;
+	if (!blocks_plugged())
+		unplug_hd();
+	return req != NULL;
 }
 
-void rw_abs_hd(int rw,unsigned int nr,unsigned int sec,unsigned int head,
-	unsigned int cyl,struct buffer_head * bh)
+/*
+ * rw_abs_hd() queues the buffer and returns: the interrupt unlocks it
+ * when it is done. It sleeps only if it can't be merged into a queued
+ * request and all the request slots are taken - except for READA, which
+ * is then just dropped.
+ */
+void rw_abs_hd(int rw,unsigned int nr,unsigned int sector,
+	struct buffer_head * bh)
 {
 	struct hd_request * req;
+	int cmd;
 
-	if (rw!=READ && rw!=WRITE)
+	if (rw!=READ && rw!=WRITE && rw!=READA)
 		panic("Bad hd command, must be R/W");
+	cmd = (rw==WRITE)?WIN_WRITE:WIN_READ;
 	lock_buffer(bh);
-repeat:
-	for (req=0+request ; req<NR_REQUEST+request ; req++)
-		if (req->hd<0)
-			break;
-	if (req==NR_REQUEST+request) {
-		sleep_on(&wait_for_request);
-		goto repeat;
+	bh->b_reqnext = NULL;
+	if (merge_request(cmd,nr,sector,bh))
+		return;
+	if (!(req = get_request(rw))) {
+		unlock_buffer(bh);	/* read-ahead is only a hint */
+		return;
 	}
 	req->hd=nr;
 	req->nsector=2;
-	req->sector=sec;
-	req->head=head;
-	req->cyl=cyl;
-	req->cmd = ((rw==READ)?WIN_READ:WIN_WRITE);
-	req->bh=bh;
+	req->sector=sector;
+	req->cmd=cmd;
+	req->bh=req->bhtail=bh;
 	req->errors=0;
 	req->next=NULL;
 	add_request(req);
-	wait_on_buffer(bh);
+}
+
+/*
+ * find_bmide() looks for a bus-master IDE controller whose primary
+ * channel is the one at HD_DATA (that is, in compatibility mode), and
+ * lets it be bus master. Without one everything is done by PIO.
+ */
+static void find_bmide(void)
+{
+	unsigned long class;
+	int devfn;
+
+	for (devfn = 0 ; (devfn = pci_find_class(PCI_CLASS_IDE,devfn)) >= 0 ;
+	    devfn++) {
+		class = pci_read(devfn,PCI_CLASS);
+		if (!(class & 0x8000) || (class & 0x100))
+			continue;
+		bmide = pci_read(devfn,PCI_BAR(4)) & 0xfffc;
+		if (!bmide)
+			continue;
+		pci_enable(devfn,PCI_CMD_IO | PCI_CMD_MASTER);
+		printk("hd: bus-master IDE at 0x%x\n\r",bmide);
+		return;
+	}
+}
+
+/*
+ * identify() asks the drive what it is. It is called by hd_init() before
+ * interrupts are on, and with nIEN set the drive doesn't raise one
+ * either, so we just poll. A drive that doesn't answer keeps the
+ * HD_TYPE values from config.h.
+ */
+static void identify(int drive)
+{
+	struct hd_i_struct * p = hd_info+drive;
+	unsigned short id[256];
+	unsigned long lba48;
+	int i,r;
+
+	p->nr_sects = p->head*p->sect*p->cyl;
+	outb_p(_CTL|2,HD_CMD);
+	outb_p(0xA0|(drive<<4),HD_CURRENT);
+	for (i=0 ; i<1000 && !controller_ready() ; i++)
+		/* nothing */ ;
+	if (i == 1000)
+		goto out;
+	outb_p(WIN_IDENTIFY,HD_COMMAND);
+	for (i=0 ; i<100000 ; i++)
+		if (!((r=inb_p(HD_STATUS)) & BUSY_STAT) &&
+		    (r & (DRQ_STAT|ERR_STAT)))
+			break;
+	if ((r & (BUSY_STAT|DRQ_STAT|ERR_STAT)) != DRQ_STAT)
+		goto out;
+	port_read(HD_DATA,id,256);
+	p->ident = 1;
+	for (i = id[47] & 0xff ; i & (i-1) ; i &= i-1)
+		/* nothing: round down to a power of two */ ;
+	p->mult = (i > MAX_MULT) ? MAX_MULT : i;
+	if (p->mult > 1) {
+		outb_p(p->mult,HD_NSECTOR);
+		outb_p(WIN_SETMULT,HD_COMMAND);
+		for (i=0 ; i<100000 && (inb_p(HD_STATUS) & BUSY_STAT) ; i++)
+			/* nothing */ ;
+		if (inb_p(HD_STATUS) & (BUSY_STAT|ERR_STAT))
+			p->mult = 0;
+	} else
+		p->mult = 0;
+	if (bmide && (id[49] & 0x100)) {
+		p->dma = 1;
+		outb_p(inb_p(bmide+BM_STATUS) | (drive ? BM_DRV1_DMA : BM_DRV0_DMA),
+			bmide+BM_STATUS);
+	}
+	if (id[1] && id[3] && id[6] && id[3] <= 16) {
+		p->cyl = id[1];
+		p->head = id[3];
+		p->sect = id[6];
+		p->nr_sects = p->head*p->sect*p->cyl;
+	}
+	if (id[49] & 0x200) {
+		p->lba = 28;
+		p->nr_sects = id[60] | ((unsigned long) id[61] << 16);
+		if (id[83] & 0x400) {
+			lba48 = id[100] | ((unsigned long) id[101] << 16);
+			if (id[102] || id[103] || lba48 > 0x7fffffff)
+				lba48 = 0x7fffffff;	/* what a long can hold */
+			if (lba48 > p->nr_sects) {
+				p->lba = 48;
+				p->nr_sects = lba48;
+			}
+		}
+	}
+out:
+	inb_p(HD_STATUS);
+	outb_p(_CTL,HD_CMD);
+	if (p->lba)
+		printk("hd%d: %d sectors, LBA%d",drive,p->nr_sects,p->lba);
+	else
+		printk("hd%d: %d sectors, CHS %d/%d/%d",drive,p->nr_sects,
+			p->cyl,p->head,p->sect);
+	if (p->mult)
+		printk(", %d sectors per interrupt",p->mult);
+	if (p->dma)
+		printk(", DMA");
+	printk("\n\r");
 }
 
 void hd_init(void)
 {
 	int i;
 
-	for (i=0 ; i<NR_REQUEST ; i++) {
-		request[i].hd = -1;
-		request[i].next = NULL;
-	}
+	for (i=0 ; i<NR_REQUEST ; i++)
+		add_free_request(request+i);
+	find_bmide();
 	for (i=0 ; i<NR_HD ; i++) {
+		identify(i);
 		hd[i*5].start_sect = 0;
-		hd[i*5].nr_sects = hd_info[i].head*
-				hd_info[i].sect*hd_info[i].cyl;
+		hd[i*5].nr_sects = hd_info[i].nr_sects;
 	}
-	set_trap_gate(0x2E,&hd_interrupt);
+	set_intr_gate(0x2E,&hd_interrupt);
 	outb_p(inb_p(0x21)&0xfb,0x21);
 	outb(inb_p(0xA1)&0xbf,0xA1);
 }
@@ -0,0 +1,215 @@
+/*
+ * md.c joins the devices in MD_DEVS (config.h) into block major 9. With
+ * MD_LEVEL 0 the blocks are striped over them, MD_CHUNK blocks at a
+ * time, so a long read keeps all of them busy. With MD_LEVEL 1 each is
+ * a copy of the others: writes go to all of them, and a read goes to
+ * the member whose last request ended nearest to it, which is where its
+ * heads are.
+ *
+ * md has no queue of its own. rw_md() gives each member a 'shadow'
+ * buffer head pointing at the data of the real one, and submits it with
+ * ll_rw_block(). md_end_io() is called as each is done, and the last
+ * one finishes the real buffer.
+ */
+#include <linux/config.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/md.h>
+#include <asm/system.h>
+
+#ifdef MD_DEVS
+
+static int md_dev[] = { MD_DEVS };
+
+#define NR_MEMBERS ((sizeof (md_dev))/(sizeof (md_dev[0])))
+
+#if (MD_LEVEL != 0 && MD_LEVEL != 1)
+#error "MD_LEVEL must be 0 (striping) or 1 (mirroring)"
+#endif
+
+#else
+
+static int md_dev[1] = { 0 };
+
+#define NR_MEMBERS 0
+
+#endif
+
+#define NR_MD_IO 32
+
+/*
+ * An md_io is one buffer in flight: the real buffer, and a shadow for
+ * each member it went to (only one, unless it is a RAID1 write).
+ */
+static struct md_io {
+	struct buffer_head * bh;	/* NULL if free */
+	int pending;
+	int uptodate;
+	int dir;			/* 0 read, 1 write */
+	struct buffer_head shadow[MD_MAX];
+} md_io[NR_MD_IO];
+
+static struct task_struct * md_wait = NULL;
+static long last_block[MD_MAX];		/* where each member got to */
+
+struct md_stat md_stat = {{0,},};
+
+static inline void lock_buffer(struct buffer_head * bh)
+{
+	if (bh->b_lock)
+		printk("md.c: buffer multiply locked\n");
+	bh->b_lock=1;
+	refile_buffer(bh);
+}
+
+static inline void unlock_buffer(struct buffer_head * bh)
+{
+	if (!bh->b_lock)
+		printk("md.c: free buffer being unlocked\n");
+	bh->b_lock=0;
+	refile_buffer(bh);
+	wake_up(&bh->b_wait);
+}
+
+/*
+ * md_end_io() is called when a member is done with its shadow, from
+ * its interrupt - or from ll_rw_block() itself, if the member dropped
+ * it. The shadow is never on the lru-lists once it is unlocked.
+ */
+static void md_end_io(struct buffer_head * sh)
+{
+	struct md_io * io;
+	struct buffer_head * bh;
+	void (*end_io)(struct buffer_head *);
+	int m;
+
+	io = md_io + ((char *) sh - (char *) md_io) / sizeof (struct md_io);
+	m = sh - io->shadow;
+	md_stat.busy[m]--;
+	if (sh->b_uptodate)
+		io->uptodate = 1;
+	else
+		md_stat.errors[m]++;
+	if (--io->pending)
+		return;
+	bh = io->bh;
+	io->bh = NULL;
+	wake_up(&md_wait);
+	iostat_done(bh,io->dir,bh->b_start);
+	bh->b_uptodate = io->uptodate;
+	if (io->uptodate)
+		bh->b_dirt = 0;
+	end_io = bh->b_end_io;
+	bh->b_end_io = NULL;
+	unlock_buffer(bh);
+	if (end_io)
+		end_io(bh);
+}
+
+static struct md_io * get_md_io(int rw)
+{
+	struct md_io * io;
+
+	cli();
+	for (;;) {
+		for (io = md_io ; io < md_io+NR_MD_IO ; io++)
+			if (!io->bh) {
+				sti();
+				return io;
+			}
+		if (rw == READA)
+			break;
+		md_stat.io_waits++;
+		sleep_on(&md_wait);
+	}
+	sti();
+	return NULL;
+}
+
+#if defined(MD_DEVS) && MD_LEVEL == 1
+/*
+ * nearest() is the RAID1 member that should read 'block'.
+ */
+static int nearest(long block)
+{
+	long d, best = 0x7fffffff;
+	int m, i = 0;
+
+	for (m = 0 ; m < NR_MEMBERS ; m++) {
+		d = block - last_block[m];
+		if (d < 0)
+			d = -d;
+		if (d < best || (d == best && md_stat.busy[m] < md_stat.busy[i])) {
+			best = d;
+			i = m;
+		}
+	}
+	return i;
+}
+#endif
+
+static void submit(struct md_io * io, int m, int rw, long block)
+{
+	struct buffer_head * sh = io->shadow + m;
+
+	sh->b_data = io->bh->b_data;
+	sh->b_dev = md_dev[m];
+	sh->b_blocknr = block;
+	sh->b_uptodate = 0;
+	sh->b_dirt = 0;
+	sh->b_count = 1;
+	sh->b_lock = 0;
+	sh->b_list = NR_LIST;
+	sh->b_wait = NULL;
+	sh->b_this_page = NULL;
+	sh->b_reqnext = NULL;
+	sh->b_end_io = md_end_io;
+	sh->b_acct = 0;
+	last_block[m] = block+1;
+	md_stat.busy[m]++;
+	if (rw == WRITE)
+		md_stat.writes[m]++;
+	else
+		md_stat.reads[m]++;
+	ll_rw_block(rw,sh);
+}
+
+void rw_md(int rw, struct buffer_head * bh)
+{
+	struct md_io * io;
+#ifdef MD_DEVS
+	long block = bh->b_blocknr;
+	int m;
+#endif
+
+	if (!NR_MEMBERS || MINOR(bh->b_dev))
+		return;
+	if (NR_MEMBERS > MD_MAX)
+		panic("md: too many devices in MD_DEVS");
+	if (rw != READ && rw != WRITE && rw != READA)
+		panic("Bad md command, must be R/W");
+	lock_buffer(bh);
+	if (!(io = get_md_io(rw))) {
+		unlock_buffer(bh);	/* read-ahead is only a hint */
+		return;
+	}
+	io->bh = bh;
+	io->uptodate = 0;
+	io->dir = (rw == WRITE);
+#if defined(MD_DEVS) && MD_LEVEL == 1
+	if (rw == WRITE) {
+		io->pending = NR_MEMBERS;
+		for (m = 0 ; m < NR_MEMBERS ; m++)
+			submit(io,m,rw,block);
+		return;
+	}
+	io->pending = 1;
+	submit(io,nearest(block),rw,block);
+#elif defined(MD_DEVS)
+	m = (block / MD_CHUNK) % NR_MEMBERS;
+	block = (block / (MD_CHUNK*NR_MEMBERS)) * MD_CHUNK + block % MD_CHUNK;
+	io->pending = 1;
+	submit(io,m,rw,block);
+#endif
+}
@@ -0,0 +1,87 @@
+/*
+ * pci.c reads and writes PCI configuration space with "mechanism 1",
+ * the address at 0xCF8 and the data at 0xCFC, which is what all the
+ * machines we care about (and qemu) have. Only bus 0 is looked at: there
+ * is nothing behind bridges that we have drivers for.
+ *
+ * The drivers only use it from their init routines, before interrupts
+ * are turned on, so the two-step access needs no cli().
+ */
+#include <linux/kernel.h>
+#include <linux/pci.h>
+#include <asm/io.h>
+
+#define PCI_ADDR	0xCF8
+#define PCI_DATA	0xCFC
+
+#define NR_DEVFN	256	/* bus 0: 32 slots of 8 functions */
+
+unsigned long pci_read(int devfn,int reg)
+{
+	unsigned long v;
+
+	outl(0x80000000 | (devfn<<8) | (reg & 0xfc),PCI_ADDR);
+	v = inl(PCI_DATA);
+	return v;
+}
+
+void pci_write(int devfn,int reg,unsigned long value)
+{
+	outl(0x80000000 | (devfn<<8) | (reg & 0xfc),PCI_ADDR);
+	outl(value,PCI_DATA);
+}
+
+/*
+ * next_devfn() is the first function from 'devfn' on that is there. The
+ * functions other than 0 of a slot are only looked at if function 0
+ * says it has more.
+ */
+static int next_devfn(int devfn)
+{
+	for ( ; devfn < NR_DEVFN ; devfn++) {
+		if ((devfn & 7) && !(pci_read(devfn & ~7,PCI_HEADER) & 0x800000))
+			continue;
+		if ((pci_read(devfn,PCI_VENDOR) & 0xffff) != 0xffff)
+			return devfn;
+	}
+	return -1;
+}
+
+/*
+ * pci_find_class() and pci_find_device() return the first matching
+ * device from 'from' on, or -1. Call them again with the last one + 1
+ * to get the next.
+ */
+int pci_find_class(int class,int from)
+{
+	while ((from = next_devfn(from)) >= 0) {
+		if ((pci_read(from,PCI_CLASS) >> 16) == class)
+			return from;
+		from++;
+	}
+	return -1;
+}
+
+int pci_find_device(int vendor,int device,int from)
+{
+	unsigned long id = ((unsigned long) device << 16) | vendor;
+
+	while ((from = next_devfn(from)) >= 0) {
+		if (pci_read(from,PCI_VENDOR) == id)
+			return from;
+		from++;
+	}
+	return -1;
+}
+
+/*
+ * pci_enable() turns on the 'cmd' bits (PCI_CMD_IO etc) of a device,
+ * and returns the old command register.
+ */
+unsigned long pci_enable(int devfn,int cmd)
+{
+	unsigned long old = pci_read(devfn,PCI_COMMAND) & 0xffff;
+
+	pci_write(devfn,PCI_COMMAND,old | cmd);
+	return old;
+}
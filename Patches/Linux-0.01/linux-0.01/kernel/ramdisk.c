@@ -0,0 +1,80 @@
+/*
+ * ramdisk.c is the RAM disk, block major 1: RAMDISK kB at the top of
+ * memory (see config.h). There is no request queue - ll_rw_block() gets
+ * its buffer copied at once, and finds it unlocked and done. The block
+ * is counted as finished before rw_ram() returns.
+ */
+#include <string.h>
+
+#include <linux/config.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+
+#if (RAMDISK & 3)
+#error "RAMDISK must be a number of whole pages"
+#endif
+
+#define RD_BLOCKS (RAMDISK*1024/BLOCK_SIZE)
+
+void rw_ram(int rw, struct buffer_head * bh)
+{
+	char * addr;
+
+	if (MINOR(bh->b_dev) || bh->b_blocknr >= RD_BLOCKS)
+		return;
+	addr = (char *) RAMDISK_START + bh->b_blocknr*BLOCK_SIZE;
+	if (rw == WRITE) {
+		memcpy(addr,bh->b_data,BLOCK_SIZE);
+		bh->b_dirt = 0;
+	} else if (rw == READ || rw == READA)
+		memcpy(bh->b_data,addr,BLOCK_SIZE);
+	else
+		panic("Bad ram disk command, must be R/W");
+	bh->b_uptodate = 1;
+	iostat_done(bh,rw == WRITE,bh->b_start);
+}
+
+/*
+ * rd_load() copies the start of RAMDISK_IMAGE into the ram disk, for
+ * sys_setup() before root is mounted. If the image is a minix file
+ * system only its blocks are copied, else the whole ram disk is filled.
+ * Block 0, the boot block, is left out: bread_multi() can't read it and
+ * the file system doesn't need it.
+ */
+void rd_load(void)
+{
+#if defined(RAMDISK_IMAGE) && RAMDISK
+	struct buffer_head * bh[NR_MULTI];
+	int block[NR_MULTI];
+	struct super_block * s;
+	int nr = RD_BLOCKS,i,j,n;
+
+	if (bh[0] = bread(RAMDISK_IMAGE,1)) {
+		s = (struct super_block *) bh[0]->b_data;
+		if (s->s_magic == SUPER_MAGIC && !s->s_log_zone_size &&
+		    s->s_nzones < nr)
+			nr = s->s_nzones;
+		brelse(bh[0]);
+	}
+	printk("Loading %d blocks into ram disk... ",nr);
+	for (i = 1 ; i < nr ; i += n) {
+		for (n = 0 ; n < NR_MULTI && i+n < nr ; n++)
+			block[n] = i+n;
+		bread_multi(RAMDISK_IMAGE,block,bh,n);
+		for (j = 0 ; j < n ; j++) {
+			if (bh[j])
+				memcpy((char *) RAMDISK_START + (i+j)*BLOCK_SIZE,
+					bh[j]->b_data,BLOCK_SIZE);
+			else
+				nr = 0;
+			brelse(bh[j]);
+		}
+		if (!nr) {
+			printk("failed\n\r");
+			return;
+		}
+	}
+	printk("done\n\r");
+#endif
+}
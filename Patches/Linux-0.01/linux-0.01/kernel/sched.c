@@ -106,6 +106,8 @@ void schedule(void)
 
 int sys_pause(void)
 {
+	if (current == task[0])		/* idle: see the end of main() */
+		zero_idle();
 	current->state = TASK_INTERRUPTIBLE;
 	schedule();
 	return 0;
@@ -156,8 +158,64 @@ void wake_up(struct task_struct **p)
 	}
 }
 
+/*
+ * add_timer() makes 'fn' get called from the timer interrupt after
+ * 'jiffies' ticks. The list is kept sorted, and each entry holds the
+ * ticks left after the one before it, so do_timer() only has to count
+ * down the first one. 'fn' runs with interrupts off, so it should do
+ * little more than wake somebody up - and must not turn them on. The
+ * callbacks may add_timer() again, so that keeps the flag as it was.
+ */
+#define TIME_REQUESTS 64
+
+static struct timer_list {
+	long jiffies;
+	void (*fn)(void);
+	struct timer_list * next;
+} timer_list[TIME_REQUESTS], * next_timer = NULL;
+
+void add_timer(long jiffies, void (*fn)(void))
+{
+	struct timer_list * p, ** q;
+	unsigned long flags;
+
+	if (!fn)
+		return;
+	save_flags(flags);
+	cli();
+	if (jiffies <= 0) {
+		restore_flags(flags);
+		(fn)();
+		return;
+	}
+	for (p = timer_list ; p < timer_list + TIME_REQUESTS ; p++)
+		if (!p->fn)
+			break;
+	if (p >= timer_list + TIME_REQUESTS)
+		panic("No more time requests free");
+	for (q = &next_timer ; *q && (*q)->jiffies <= jiffies ; q = &(*q)->next)
+		jiffies -= (*q)->jiffies;
+	p->fn = fn;
+	p->jiffies = jiffies;
+	if ((p->next = *q))
+		(*q)->jiffies -= jiffies;
+	*q = p;
+	restore_flags(flags);
+}
+
 void do_timer(long cpl)
 {
+	if (next_timer) {
+		next_timer->jiffies--;
+		while (next_timer && next_timer->jiffies <= 0) {
+			void (*fn)(void);
+
+			fn = next_timer->fn;
+			next_timer->fn = NULL;
+			next_timer = next_timer->next;
+			(fn)();
+		}
+	}
 	if (cpl)
 		current->utime++;
 	else
@@ -45,9 +45,10 @@ signal	= 12
 restorer = 16		# address of info-restorer
 sig_fn	= 20		# table of 32 signal addresses
 
-nr_system_calls = 67
+nr_system_calls = 69
 
 .globl _system_call,_sys_fork,_timer_interrupt,_hd_interrupt,_sys_execve
+.globl _vd_interrupt
 
 .align 2
 bad_sys_call:
@@ -204,7 +205,8 @@ _hd_interrupt:
 	jmp 1f			# give port chance to breathe
 1:	jmp 1f
 1:	outb %al,$0xA0		# same to controller #2
-	movl _do_hd,%eax
+	xorl %eax,%eax
+	xchgl _do_hd,%eax	# one interrupt, one call: clear it first
 	testl %eax,%eax
 	jne 1f
 	movl $_unexpected_hd_interrupt,%eax
@@ -217,3 +219,28 @@ _hd_interrupt:
 	popl %eax
 	iret
 
+_vd_interrupt:
+	pushl %eax
+	pushl %ecx
+	pushl %edx
+	push %ds
+	push %es
+	push %fs
+	movl $0x10,%eax
+	mov %ax,%ds
+	mov %ax,%es
+	movl $0x17,%eax
+	mov %ax,%fs
+	movb $0x20,%al
+	outb %al,$0x20		# EOI to interrupt controller #1
+	jmp 1f			# give port chance to breathe
+1:	jmp 1f
+1:	outb %al,$0xA0		# same to controller #2
+	call _vd_intr		# interrupts stay off: it's an intr gate
+	pop %fs
+	pop %es
+	pop %ds
+	popl %edx
+	popl %ecx
+	popl %eax
+	iret
@@ -0,0 +1,368 @@
+/*
+ * vd.c is the driver for virtio block devices (major 8), the disks qemu
+ * and friends give a guest when asked for if=virtio. Unlike the hd
+ * emulation it costs no i/o-port trips per sector: a request is a chain
+ * of descriptors in memory, and the device is told about new chains
+ * with a single write to VIRTIO_QUEUE_NOTIFY.
+ *
+ * Buffers wait on a pending list per direction, in block order. When
+ * the device isn't busy, or when it has finished some chains, all of
+ * them are made into chains - buffers that follow each other on the
+ * disk going into the same chain - and the device is notified once.
+ * Minors are like those of hd: 0 the whole disk, 1-4 its partitions.
+ */
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/hdreg.h>
+#include <linux/pci.h>
+#include <linux/virtio.h>
+#include <sys/iostat.h>
+#include <asm/system.h>
+#include <asm/io.h>
+
+#define VD_MAJOR	8
+#define MAX_VD		2
+#define VQ_MAX		256	/* largest queue we have ring memory for */
+#define VQ_PAGES	3	/* ... which is VRING_SIZE(VQ_MAX) */
+#define MAX_SEG		16	/* buffers in one chain */
+
+struct vd_req {
+	struct virtio_blk_hdr hdr;
+	unsigned char status;
+	long issued;			/* jiffies when given to the device */
+	struct buffer_head * bh;	/* linked by b_reqnext */
+};
+
+static struct vd_struct {
+	int iobase;		/* 0 if there is no such disk */
+	int irq;
+	int qsize;
+	struct vring_desc * desc;
+	struct vring_avail * avail;
+	volatile struct vring_used * used;
+	int free_desc;		/* free descriptors, linked by 'next' */
+	int nr_free;
+	unsigned short last_used;
+	int busy;		/* chains the device has */
+	long next_sector;	/* where the last chain ended */
+	struct buffer_head * pending[2];
+	struct vd_req req[VQ_MAX];	/* by head descriptor */
+} vd[MAX_VD];
+
+static struct vd_part {
+	long start_sect;
+	long nr_sects;
+} vd_part[5*MAX_VD];
+
+static char vq_mem[MAX_VD][VQ_PAGES*4096] __attribute__ ((aligned (4096)));
+
+extern void vd_interrupt(void);
+
+#define barrier() __asm__ __volatile__("":::"memory")
+
+#define SECTOR(bh) (vd_part[MINOR((bh)->b_dev)].start_sect + \
+	((bh)->b_blocknr << 1))
+
+static inline void lock_buffer(struct buffer_head * bh)
+{
+	if (bh->b_lock)
+		printk("vd.c: buffer multiply locked\n");
+	bh->b_lock=1;
+	refile_buffer(bh);
+}
+
+static inline void unlock_buffer(struct buffer_head * bh)
+{
+	if (!bh->b_lock)
+		printk("vd.c: free buffer being unlocked\n");
+	bh->b_lock=0;
+	refile_buffer(bh);
+	wake_up(&bh->b_wait);
+}
+
+static int get_desc(struct vd_struct * d)
+{
+	int i = d->free_desc;
+
+	d->free_desc = d->desc[i].next;
+	d->nr_free--;
+	return i;
+}
+
+/*
+ * add_chain() makes the first buffers on d->pending[dir] into a chain:
+ * the header, as many buffers as follow each other on the disk, and the
+ * status byte. It returns 0 if there aren't descriptors for it.
+ */
+static int add_chain(struct vd_struct * d, int dir)
+{
+	struct buffer_head * bh = d->pending[dir], * last;
+	struct vd_req * req;
+	int head,prev,i,n;
+
+	for (n = 1, last = bh ; n < MAX_SEG && last->b_reqnext ; n++) {
+		if (SECTOR(last->b_reqnext) != SECTOR(last)+2)
+			break;
+		last = last->b_reqnext;
+	}
+	if (d->nr_free < n+2)
+		return 0;
+	d->pending[dir] = last->b_reqnext;
+	last->b_reqnext = NULL;
+	head = get_desc(d);
+	req = d->req + head;
+	req->hdr.type = dir ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	req->hdr.ioprio = 0;
+	req->hdr.sector = SECTOR(bh);
+	req->hdr.sector_high = 0;
+	req->status = 0xff;
+	req->issued = jiffies;
+	req->bh = bh;
+	if (n > 1)
+		find_iostat(bh->b_dev)->merges[dir] += n-1;
+	if (req->hdr.sector != d->next_sector)
+		find_iostat(bh->b_dev)->seeks++;
+	d->next_sector = req->hdr.sector + 2*n;
+	d->desc[head].addr = (unsigned long) &req->hdr;
+	d->desc[head].len = sizeof (struct virtio_blk_hdr);
+	d->desc[head].flags = VRING_DESC_F_NEXT;
+	prev = head;
+	for ( ; bh ; bh = bh->b_reqnext) {
+		d->desc[prev].next = i = get_desc(d);
+		d->desc[i].addr = (unsigned long) bh->b_data;
+		d->desc[i].len = BLOCK_SIZE;
+		d->desc[i].flags = VRING_DESC_F_NEXT |
+			(dir ? 0 : VRING_DESC_F_WRITE);
+		prev = i;
+	}
+	d->desc[prev].next = i = get_desc(d);
+	d->desc[i].addr = (unsigned long) &req->status;
+	d->desc[i].len = 1;
+	d->desc[i].flags = VRING_DESC_F_WRITE;
+	d->avail->ring[d->avail->idx % d->qsize] = head;
+	barrier();
+	d->avail->idx++;
+	d->busy++;
+	return 1;
+}
+
+/*
+ * start_vd() hands all pending buffers it has descriptors for to the
+ * device, reads first, and notifies it once. Called with interrupts off.
+ */
+static void start_vd(struct vd_struct * d)
+{
+	int dir,n = 0;
+
+	for (dir = READ ; dir <= WRITE ; dir++)
+		while (d->pending[dir] && add_chain(d,dir))
+			n++;
+	barrier();
+	if (n)
+		outw(0,d->iobase+VIRTIO_QUEUE_NOTIFY);
+}
+
+/*
+ * unplug_vd() starts the disks that have nothing to do but have
+ * buffers pending, which they may have when they were plugged. The
+ * plug timer calls it too, so it leaves the interrupt flag alone.
+ */
+void unplug_vd(void)
+{
+	struct vd_struct * d;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	for (d = vd ; d < vd+MAX_VD ; d++)
+		if (d->iobase && !d->busy)
+			start_vd(d);
+	restore_flags(flags);
+}
+
+/*
+ * rw_vd() puts the buffer on its pending list, in block order, and
+ * starts it if the device has nothing to do and isn't plugged. As with
+ * hd, the interrupt unlocks it when it is done.
+ */
+void rw_vd(int rw, struct buffer_head * bh)
+{
+	struct vd_struct * d;
+	struct buffer_head ** p;
+	unsigned int dev = MINOR(bh->b_dev);
+	long sector;
+
+	if (dev >= 5*MAX_VD || !(d = vd + dev/5)->iobase ||
+	    (bh->b_blocknr << 1)+2 > vd_part[dev].nr_sects)
+		return;
+	if (rw == READA)
+		rw = READ;
+	else if (rw != READ && rw != WRITE)
+		panic("Bad vd command, must be R/W");
+	lock_buffer(bh);
+	sector = SECTOR(bh);
+	cli();
+	for (p = &d->pending[rw] ; *p && SECTOR(*p) < sector ;
+	    p = &(*p)->b_reqnext)
+		/* nothing */ ;
+	bh->b_reqnext = *p;
+	*p = bh;
+	if (!d->busy && !blocks_plugged())
+		start_vd(d);
+	sti();
+}
+
+static void end_chain(struct vd_struct * d, int head)
+{
+	struct vd_req * req = d->req + head;
+	struct buffer_head * bh;
+	void (*end_io)(struct buffer_head *);
+	int i = head, uptodate = (req->status == VIRTIO_BLK_S_OK);
+
+	while (d->desc[i].flags & VRING_DESC_F_NEXT)
+		i = d->desc[i].next;
+	d->desc[i].next = d->free_desc;
+	d->free_desc = head;
+	for (bh = req->bh ; bh ; bh = req->bh) {
+		d->nr_free++;
+		req->bh = bh->b_reqnext;
+		bh->b_reqnext = NULL;
+		iostat_done(bh,req->hdr.type == VIRTIO_BLK_T_OUT,req->issued);
+		bh->b_uptodate = uptodate;
+		if (uptodate)
+			bh->b_dirt = 0;
+		end_io = bh->b_end_io;
+		bh->b_end_io = NULL;
+		unlock_buffer(bh);
+		if (end_io)
+			end_io(bh);
+	}
+	d->nr_free += 2;
+	d->busy--;
+	if (!uptodate)
+		printk("vd%d: I/O error, sector %d\n\r",d-vd,req->hdr.sector);
+}
+
+/*
+ * vd_intr() is called from vd_interrupt (system_call.s) with interrupts
+ * off, and nothing it calls turns them on. Reading VIRTIO_ISR lowers
+ * the irq line of a device. last_used is moved on before a chain is
+ * ended, so the ring is right whatever b_end_io does.
+ */
+void vd_intr(void)
+{
+	struct vd_struct * d;
+	int head;
+
+	for (d = vd ; d < vd+MAX_VD ; d++) {
+		if (!d->iobase || !(inb(d->iobase+VIRTIO_ISR) & 1))
+			continue;
+		while (d->last_used != d->used->idx) {
+			barrier();
+			head = d->used->ring[d->last_used % d->qsize].id;
+			d->last_used++;
+			end_chain(d,head);
+		}
+		start_vd(d);
+	}
+}
+
+/*
+ * vd_setup() reads the partition tables, for sys_setup(). A disk without
+ * one can still be used whole, as minor 0.
+ */
+void vd_setup(void)
+{
+	struct partition * p;
+	int nr,i;
+
+	for (nr = 0 ; nr < MAX_VD ; nr++) {
+		if (!vd[nr].iobase)
+			continue;
+		start_buffer->b_dev = (VD_MAJOR<<8) + nr*5;
+		start_buffer->b_blocknr = 0;
+		rw_vd(READ,start_buffer);
+		wait_on_buffer(start_buffer);
+		if (!start_buffer->b_uptodate) {
+			printk("vd%d: unable to read partition table\n\r",nr);
+			continue;
+		}
+		if (start_buffer->b_data[510] != 0x55 || (unsigned char)
+		    start_buffer->b_data[511] != 0xAA) {
+			printk("vd%d: no partition table\n\r",nr);
+			continue;
+		}
+		p = 0x1BE + (void *)start_buffer->b_data;
+		for (i=1;i<5;i++,p++) {
+			vd_part[i+5*nr].start_sect = p->start_sect;
+			vd_part[i+5*nr].nr_sects = p->nr_sects;
+		}
+	}
+	start_buffer->b_dev = 0;
+	refile_buffer(start_buffer);
+}
+
+/*
+ * init_vd() brings up one device: reset, tell it we know what it is,
+ * ask for no features, and give it the memory for queue 0.
+ */
+static int init_vd(struct vd_struct * d, int devfn, char * mem)
+{
+	unsigned long cap;
+	int i;
+
+	d->iobase = pci_read(devfn,PCI_BAR(0)) & 0xfffc;
+	d->irq = pci_read(devfn,PCI_IRQ) & 0xff;
+	if (!d->iobase || d->irq >= 16 || d->irq == 14)	/* 14 is hd's */
+		return d->iobase = 0;
+	pci_enable(devfn,PCI_CMD_IO | PCI_CMD_MASTER);
+	outb(0,d->iobase+VIRTIO_STATUS);
+	outb(VIRTIO_ACKNOWLEDGE,d->iobase+VIRTIO_STATUS);
+	outb(VIRTIO_ACKNOWLEDGE|VIRTIO_DRIVER,d->iobase+VIRTIO_STATUS);
+	outl(0,d->iobase+VIRTIO_GUEST_FEATURES);
+	outw(0,d->iobase+VIRTIO_QUEUE_SEL);
+	d->qsize = inw(d->iobase+VIRTIO_QUEUE_SIZE);
+	if (!d->qsize || d->qsize > VQ_MAX) {
+		printk("vd: queue size %d not supported\n\r",d->qsize);
+		outb(VIRTIO_FAILED,d->iobase+VIRTIO_STATUS);
+		return d->iobase = 0;
+	}
+	d->desc = (struct vring_desc *) mem;
+	d->avail = (struct vring_avail *) (mem +
+		d->qsize*sizeof (struct vring_desc));
+	d->used = (struct vring_used *) (mem + VRING_USED_OFFSET(d->qsize));
+	for (i = 0 ; i < d->qsize ; i++)
+		d->desc[i].next = i+1;
+	d->free_desc = 0;
+	d->nr_free = d->qsize;
+	outl(((unsigned long) mem) >> 12,d->iobase+VIRTIO_QUEUE_PFN);
+	cap = inl(d->iobase+VIRTIO_BLK_CAPACITY);
+	if (inl(d->iobase+VIRTIO_BLK_CAPACITY+4) || cap > 0x7fffffff)
+		cap = 0x7fffffff;	/* what a long can hold */
+	vd_part[5*(d-vd)].nr_sects = cap;
+	outb(VIRTIO_ACKNOWLEDGE|VIRTIO_DRIVER|VIRTIO_DRIVER_OK,
+		d->iobase+VIRTIO_STATUS);
+	return 1;
+}
+
+void vd_init(void)
+{
+	int devfn,nr = 0;
+
+	for (devfn = 0 ; nr < MAX_VD && (devfn = pci_find_device(VIRTIO_VENDOR,
+	    VIRTIO_BLK_DEVICE,devfn)) >= 0 ; devfn++) {
+		if (!init_vd(vd+nr,devfn,vq_mem[nr]))
+			continue;
+		printk("vd%d: %d sectors, queue %d, irq %d\n\r",nr,
+			vd_part[5*nr].nr_sects,vd[nr].qsize,vd[nr].irq);
+		set_intr_gate(0x20+vd[nr].irq,&vd_interrupt);
+		if (vd[nr].irq < 8)
+			outb_p(inb_p(0x21) & ~(1 << vd[nr].irq),0x21);
+		else {
+			outb_p(inb_p(0x21) & 0xfb,0x21);
+			outb(inb_p(0xA1) & ~(1 << (vd[nr].irq-8)),0xA1);
+		}
+		nr++;
+	}
+}
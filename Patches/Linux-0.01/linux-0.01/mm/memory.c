@@ -1,8 +1,11 @@
 #include <signal.h>
+#include <string.h>
 
 #include <linux/config.h>
 #include <linux/head.h>
+#include <linux/sched.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <asm/system.h>
 
 int do_exit(long code);
@@ -17,7 +20,7 @@ __asm__("movl %%eax,%%cr3"::"a" (0))
 #endif
 
 /* these are not to be changed - thay are calculated from the above */
-#define PAGING_MEMORY (HIGH_MEMORY - LOW_MEM)
+#define PAGING_MEMORY (RAMDISK_START - LOW_MEM)
 #define PAGING_PAGES (PAGING_MEMORY/4096)
 #define MAP_NR(addr) (((addr)-LOW_MEM)>>12)
 
@@ -29,31 +32,224 @@ __asm__("movl %%eax,%%cr3"::"a" (0))
 __asm__("cld ; rep ; movsl"::"S" (from),"D" (to),"c" (1024):"cx","di","si")
 
 static unsigned short mem_map [ PAGING_PAGES ] = {0,};
+int nr_free_pages = 0;
 
 /*
- * Get physical address of first (actually last :-) free page, and mark it
- * used. If no free pages left, return 0.
+ * The free pages are kept by a buddy system. A free block is 2^order
+ * pages (order < NR_ORDERS), aligned on its size counting from LOW_MEM,
+ * and is on the free list of its order, linked through its first page.
+ * free_order[] of that first page is order+1, and 0 for all pages that
+ * don't start a free block. Freeing a block joins it with its buddy -
+ * the other half of the block twice its size - as long as that one is
+ * free and whole too. mem_map[] still counts the users of each page.
  */
+struct free_block {
+	struct free_block * next;
+	struct free_block * prev;
+};
+
+#define BLOCK(nr) ((struct free_block *) (LOW_MEM + ((nr)<<12)))
+#define BLOCK_NR(b) MAP_NR((unsigned long) (b))
+
+static struct free_block * free_area[NR_ORDERS] = {NULL,};
+static unsigned char free_order [ PAGING_PAGES ] = {0,};
+
+struct page_stat page_stat;
+
+static void add_free(int nr, int order)
+{
+	struct free_block * b = BLOCK(nr);
+
+	if ((b->next = free_area[order]))
+		b->next->prev = b;
+	b->prev = NULL;
+	free_area[order] = b;
+	free_order[nr] = order+1;
+	page_stat.free_blocks[order]++;
+}
+
+static void del_free(int nr, int order)
+{
+	struct free_block * b = BLOCK(nr);
+
+	if (b->prev)
+		b->prev->next = b->next;
+	else
+		free_area[order] = b->next;
+	if (b->next)
+		b->next->prev = b->prev;
+	free_order[nr] = 0;
+	page_stat.free_blocks[order]--;
+}
+
+static void free_buddy(int nr)
+{
+	int order, buddy;
+
+	for (order = 0 ; order < NR_ORDERS-1 ; order++) {
+		buddy = nr ^ (1<<order);
+		if (buddy >= PAGING_PAGES || free_order[buddy] != order+1)
+			break;
+		del_free(buddy,order);
+		page_stat.merges++;
+		nr &= ~(1<<order);
+	}
+	add_free(nr,order);
+}
+
+/*
+ * mem_init() puts all of the paging memory on the free lists, in the
+ * biggest blocks that fit.
+ */
+void mem_init(void)
+{
+	int nr, order;
+
+	for (nr = 0 ; nr < PAGING_PAGES ; nr += 1<<order) {
+		order = NR_ORDERS-1;
+		while ((nr & ((1<<order)-1)) || nr+(1<<order) > PAGING_PAGES)
+			order--;
+		add_free(nr,order);
+	}
+	nr_free_pages = PAGING_PAGES;
+}
+
+/*
+ * The idle task keeps up to NR_ZERO pages cleared in advance, in
+ * zero_pool[], so get_free_page() doesn't have to clear one in the
+ * middle of a page fault or a fork. The pool's pages are used as far as
+ * the buddy system knows, but count in nr_free_pages: when memory runs
+ * out they go back to the free lists.
+ */
+#define NR_ZERO 32
+
+#define clear_pages(addr,n) \
+__asm__("cld ; rep ; stosl"::"a" (0),"D" (addr),"c" (1024*(n)):"cx","di")
+
+static unsigned long zero_pool[NR_ZERO];
+static int nr_zero = 0;
+
+static int shrink_text(void);
+
+static void drain_zero_pool(void)
+{
+	int nr;
+
+	while (nr_zero) {
+		nr = MAP_NR(zero_pool[--nr_zero]);
+		mem_map[nr] = 0;
+		free_buddy(nr);
+	}
+	page_stat.zero_pool = 0;
+}
+
+/*
+ * __get_free_pages() gets 2^order contiguous free pages, as they are,
+ * and marks them used. If there is no free block big enough, return 0.
+ * A bigger block is split, the halves not needed going back on the free
+ * lists. Before giving up it takes back the zero pool, and then the
+ * text pages only the cache holds.
+ */
+unsigned long __get_free_pages(int order)
+{
+	int nr, i;
+	int k;
+
+	if (order < 0 || order >= NR_ORDERS)
+		return 0;
+repeat:
+	for (k = order ; k < NR_ORDERS && !free_area[k] ; k++)
+		/* nothing */ ;
+	if (k >= NR_ORDERS) {
+		if (nr_zero) {
+			drain_zero_pool();
+			goto repeat;
+		}
+		if (shrink_text())
+			goto repeat;
+		page_stat.failed[order]++;
+		if (nr_free_pages >= (1<<order))
+			page_stat.fragmented[order]++;
+		return 0;
+	}
+	page_stat.allocs[order]++;
+	page_stat.splits += k - order;
+	nr = BLOCK_NR(free_area[k]);
+	del_free(nr,k);
+	while (k > order) {
+		k--;
+		add_free(nr+(1<<k),k);
+	}
+	for (i = 0 ; i < (1<<order) ; i++)
+		mem_map[nr+i] = 1;
+	nr_free_pages -= 1<<order;
+	return (unsigned long) BLOCK(nr);
+}
+
+unsigned long __get_free_page(void)
+{
+	return __get_free_pages(0);
+}
+
+/*
+ * get_free_pages() and get_free_page() give cleared pages. A single
+ * page comes from the zero pool if there is one there.
+ */
+unsigned long get_free_pages(int order)
+{
+	unsigned long addr;
+
+	if ((addr = __get_free_pages(order)))
+		clear_pages(addr,1<<order);
+	return addr;
+}
+
 unsigned long get_free_page(void)
 {
-register unsigned long __res asm("ax");
-
-__asm__("std ; repne ; scasw\n\t"
-	"jne 1f\n\t"
-	"movw $1,2(%%edi)\n\t"
-	"sall $12,%%ecx\n\t"
-	"movl %%ecx,%%edx\n\t"
-	"addl %2,%%edx\n\t"
-	"movl $1024,%%ecx\n\t"
-	"leal 4092(%%edx),%%edi\n\t"
-	"rep ; stosl\n\t"
-	"movl %%edx,%%eax\n"
-	"1:"
-	:"=a" (__res)
-	:"0" (0),"i" (LOW_MEM),"c" (PAGING_PAGES),
-	"D" (mem_map+PAGING_PAGES-1)
-	:"di","cx","dx");
-return __res;
+	unsigned long addr;
+
+	if (nr_zero) {
+		page_stat.zero_hits++;
+		page_stat.zero_pool = --nr_zero;
+		nr_free_pages--;
+		return zero_pool[nr_zero];
+	}
+	page_stat.zero_misses++;
+	if ((addr = __get_free_pages(0)))
+		clear_pages(addr,1);
+	return addr;
+}
+
+/*
+ * zero_idle() is called by the idle task each time round, and clears
+ * one page for the pool. The task can't be preempted in the kernel,
+ * so the pool needs no locking. The page is taken straight off the
+ * single-page free list, and only if there is one there: splitting a
+ * bigger block, or going to __get_free_pages() - which drains the pool
+ * and the text cache when memory is short - would undo more than it
+ * gained.
+ */
+void zero_idle(void)
+{
+	unsigned long addr;
+	int nr;
+
+	if (nr_zero >= NR_ZERO)
+		return;
+	cli();
+	if (!free_area[0]) {
+		sti();
+		return;
+	}
+	nr = BLOCK_NR(free_area[0]);
+	del_free(nr,0);
+	mem_map[nr] = 1;
+	sti();
+	addr = (unsigned long) BLOCK(nr);
+	clear_pages(addr,1);
+	zero_pool[nr_zero++] = addr;	/* still counts in nr_free_pages */
+	page_stat.zero_pool = nr_zero;
+	page_stat.zero_filled++;
 }
 
 /*
@@ -63,13 +259,27 @@ return __res;
 void free_page(unsigned long addr)
 {
 	if (addr<LOW_MEM) return;
-	if (addr>HIGH_MEMORY)
+	if (addr>=LOW_MEM+PAGING_MEMORY)
 		panic("trying to free nonexistent page");
-	addr -= LOW_MEM;
-	addr >>= 12;
-	if (mem_map[addr]--) return;
-	mem_map[addr]=0;
-	panic("trying to free free page");
+	addr = MAP_NR(addr);
+	if (!mem_map[addr])
+		panic("trying to free free page");
+	if (--mem_map[addr])
+		return;
+	nr_free_pages++;
+	free_buddy(addr);
+}
+
+/*
+ * free_pages() gives back what get_free_pages() gave. The pages go one
+ * at a time, and are joined again on the way.
+ */
+void free_pages(unsigned long addr, int order)
+{
+	int i;
+
+	for (i = 0 ; i < (1<<order) ; i++)
+		free_page(addr + (i<<12));
 }
 
 /*
@@ -163,34 +373,61 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 }
 
 /*
- * This function puts a page in memory at the wanted address.
- * It returns the physical address of the page gotten, 0 if
- * out of memory (either when trying to access page-table or
- * page.)
+ * Get a page for a process. When there are none left, the buffer cache
+ * has to give back some of the pages it has grown into, a few at a time
+ * so the next faults don't have to go looking again. A page that will
+ * be copied over at once needn't be cleared first.
  */
-unsigned long put_page(unsigned long page,unsigned long address)
+static unsigned long get_user_page(int clear)
+{
+	unsigned long (*get)(void) = clear ? get_free_page : __get_free_page;
+	unsigned long page;
+
+	if (!(page = get()) && shrink_buffers(4))
+		page = get();
+	return page;
+}
+
+/*
+ * map_page() enters 'page' at 'address' with the protection bits
+ * 'prot' (7 is user, writable and present, 5 the same read-only),
+ * getting a page table if there isn't one. 0 if out of memory.
+ */
+static unsigned long map_page(unsigned long page,unsigned long address,
+	int prot)
 {
 	unsigned long tmp, *page_table;
 
 /* NOTE !!! This uses the fact that _pg_dir=0 */
 
-	if (page < LOW_MEM || page > HIGH_MEMORY)
-		printk("Trying to put page %p at %p\n",page,address);
-	if (mem_map[(page-LOW_MEM)>>12] != 1)
-		printk("mem_map disagrees with %p at %p\n",page,address);
 	page_table = (unsigned long *) ((address>>20) & 0xffc);
 	if ((*page_table)&1)
 		page_table = (unsigned long *) (0xfffff000 & *page_table);
 	else {
-		if (!(tmp=get_free_page()))
+		if (!(tmp=get_user_page(1)))
 			return 0;
 		*page_table = tmp|7;
 		page_table = (unsigned long *) tmp;
 	}
-	page_table[(address>>12) & 0x3ff] = page | 7;
+	page_table[(address>>12) & 0x3ff] = page | prot;
 	return page;
 }
 
+/*
+ * This function puts a page in memory at the wanted address.
+ * It returns the physical address of the page gotten, 0 if
+ * out of memory (either when trying to access page-table or
+ * page.)
+ */
+unsigned long put_page(unsigned long page,unsigned long address)
+{
+	if (page < LOW_MEM || page > HIGH_MEMORY)
+		printk("Trying to put page %p at %p\n",page,address);
+	if (mem_map[(page-LOW_MEM)>>12] != 1)
+		printk("mem_map disagrees with %p at %p\n",page,address);
+	return map_page(page,address,7);
+}
+
 void un_wp_page(unsigned long * table_entry)
 {
 	unsigned long old_page,new_page;
@@ -200,7 +437,7 @@ void un_wp_page(unsigned long * table_entry)
 		*table_entry |= 2;
 		return;
 	}
-	if (!(new_page=get_free_page()))
+	if (!(new_page=get_user_page(0)))
 		do_exit(SIGSEGV);
 	if (old_page >= LOW_MEM)
 		mem_map[MAP_NR(old_page)]--;
@@ -234,11 +471,248 @@ void write_verify(unsigned long address)
 	return;
 }
 
+/*
+ * exec doesn't read the program in: its text and data pages are read
+ * from current->executable when they are first used. They follow the
+ * header block in the file (N_TXTOFF == BLOCK_SIZE), so the page at
+ * 'offset' is file blocks 1+offset/BLOCK_SIZE and the three after it.
+ * The pages after the one wanted are read along with it, up to
+ * FAULT_AROUND in all, as long as they are still missing: most programs
+ * go on to use them anyway, and one bread_multi() is cheaper than many.
+ * What is past end_data in the last page is bss, and stays cleared.
+ */
+#define FAULT_AROUND 4		/* 16 blocks, NR_MULTI */
+
+static unsigned long * page_entry(unsigned long address)
+{
+	unsigned long dir = *(unsigned long *) ((address>>20) & 0xffc);
+
+	if (!(dir & 1))
+		return NULL;
+	return ((address>>12) & 0x3ff) + (unsigned long *) (0xfffff000 & dir);
+}
+
+/*
+ * Text pages that have been read are kept in a cache, by device, inode
+ * and page, so the next process running the same program - or the same
+ * one after a while - gets them without reading the disk. They are
+ * mapped read-only, and the cache holds a reference of its own in
+ * mem_map[], so a process writing to one gets a copy of it as with
+ * fork. Writing or truncating the file throws its pages out, see
+ * invalidate_text(). An entry whose page nobody else maps can be
+ * reused, and shrink_text() gives all such pages back when memory is
+ * short.
+ *
+ * Every write calls invalidate_text(), so text_inodes[] counts the
+ * cached pages by inode alone: most files have none, and that is seen
+ * without looking at the cache.
+ */
+#define NR_TEXT		128
+#define NR_TEXT_HASH	61
+#define text_hash(dev,nr,index) (((unsigned) ((dev)^(nr)^(index)))%NR_TEXT_HASH)
+#define inode_hash(dev,nr) (((unsigned) ((dev)^(nr)))%NR_TEXT_HASH)
+
+static struct text_page {
+	unsigned short dev, nr;		/* the inode */
+	unsigned long index;		/* page in the text */
+	unsigned long page;		/* 0 if the entry is free */
+	struct text_page * next;	/* hash chain */
+} text_cache[NR_TEXT];
+
+static struct text_page * text_table[NR_TEXT_HASH];
+static int text_inodes[NR_TEXT_HASH];
+static int nr_text = 0;
+static int text_hand = 0;
+
+static struct text_page * find_text(int dev, int nr, unsigned long index)
+{
+	struct text_page * t;
+
+	for (t = text_table[text_hash(dev,nr,index)] ; t ; t = t->next)
+		if (t->dev == dev && t->nr == nr && t->index == index)
+			return t;
+	return NULL;
+}
+
+static void drop_text(struct text_page * t)
+{
+	struct text_page ** p = &text_table[text_hash(t->dev,t->nr,t->index)];
+
+	while (*p != t)
+		p = &(*p)->next;
+	*p = t->next;
+	free_page(t->page);
+	t->page = 0;
+	text_inodes[inode_hash(t->dev,t->nr)]--;
+	nr_text--;
+}
+
+/*
+ * cache_text() adds a freshly read text page to the cache, if there is
+ * an entry free or one that only the cache uses. Returns 1 if it did.
+ */
+static int cache_text(unsigned long page, unsigned long index)
+{
+	struct m_inode * inode = current->executable;
+	struct text_page * t;
+	int i;
+
+	for (i = 0 ; i < NR_TEXT ; i++) {
+		t = text_cache + text_hand;
+		text_hand = (text_hand+1) % NR_TEXT;
+		if (!t->page)
+			break;
+		if (mem_map[MAP_NR(t->page)] == 1) {
+			drop_text(t);
+			break;
+		}
+	}
+	if (i >= NR_TEXT)
+		return 0;
+	t->dev = inode->i_dev;
+	t->nr = inode->i_num;
+	t->index = index;
+	t->page = page;
+	t->next = text_table[text_hash(t->dev,t->nr,index)];
+	text_table[text_hash(t->dev,t->nr,index)] = t;
+	mem_map[MAP_NR(page)]++;
+	text_inodes[inode_hash(t->dev,t->nr)]++;
+	nr_text++;
+	return 1;
+}
+
+/*
+ * map_text() maps a cached text page read-only at 'address'. Returns 0
+ * if there was no memory for the page table.
+ */
+static int map_text(struct text_page * t, unsigned long address)
+{
+	unsigned long page = t->page;
+
+	mem_map[MAP_NR(page)]++;	/* first: shrink_text() mustn't take it */
+	if (!map_page(page,address,5)) {
+		free_page(page);
+		return 0;
+	}
+	return 1;
+}
+
+static int share_text_page(unsigned long address, unsigned long offset)
+{
+	struct text_page * t;
+
+	if (!(t = find_text(current->executable->i_dev,
+	    current->executable->i_num,offset>>12))) {
+		page_stat.text_misses++;
+		return 0;
+	}
+	if (!map_text(t,address))
+		return 0;
+	page_stat.text_hits++;
+	return 1;
+}
+
+void invalidate_text(int dev, int nr)
+{
+	struct text_page * t;
+
+	if (!text_inodes[inode_hash(dev,nr)])
+		return;
+	for (t = text_cache ; t < text_cache+NR_TEXT ; t++)
+		if (t->page && t->dev == dev && t->nr == nr) {
+			drop_text(t);
+			page_stat.text_dropped++;
+		}
+}
+
+/*
+ * shrink_text() gives back the cached text pages nobody maps. It is
+ * only for an allocation that would fail otherwise, once the zero pool
+ * is drained - never for the idle refill, which would empty the cache
+ * each time the machine is idle with memory short.
+ */
+static int shrink_text(void)
+{
+	struct text_page * t;
+	int n = 0;
+
+	for (t = text_cache ; t < text_cache+NR_TEXT ; t++)
+		if (t->page && mem_map[MAP_NR(t->page)] == 1) {
+			drop_text(t);
+			n++;
+		}
+	return n;
+}
+
+#define is_text(offset) ((offset)+PAGE_SIZE <= current->end_code)
+
+static int read_exec_pages(unsigned long address, unsigned long offset)
+{
+	struct m_inode * inode = current->executable;
+	struct buffer_head * bh[4*FAULT_AROUND];
+	int block[4*FAULT_AROUND];
+	struct text_page * t;
+	unsigned long page, * entry;
+	int i, j, n, nr = 1 + offset/BLOCK_SIZE;
+
+	for (n = 1 ; n < FAULT_AROUND ; n++)
+		if (offset + n*PAGE_SIZE >= current->end_data ||
+		    ((entry = page_entry(address + n*PAGE_SIZE)) && (*entry & 1)) ||
+		    (is_text(offset + n*PAGE_SIZE) && find_text(inode->i_dev,
+		    inode->i_num,(offset>>12) + n)))
+			break;
+	for (i = 0 ; i < 4*n ; i++)
+		block[i] = (offset + i*BLOCK_SIZE < current->end_data) ?
+			bmap(inode,nr+i) : 0;
+	bread_multi(inode->i_dev,block,bh,4*n);
+	for (i = 0 ; i < n ; i++) {
+		for (j = 4*i ; j < 4*i+4 ; j++)
+			if (block[j] && !bh[j])
+				break;
+		if (j < 4*i+4 || !(page = get_user_page(1)))
+			break;
+		for (j = 0 ; j < 4 ; j++)
+			if (bh[4*i+j])
+				memcpy((char *) page + j*BLOCK_SIZE,
+					bh[4*i+j]->b_data,BLOCK_SIZE);
+		if ((j = current->end_data - offset) < PAGE_SIZE)
+			memset((char *) page + j,0,PAGE_SIZE-j);
+		if (is_text(offset) && (t = find_text(inode->i_dev,
+		    inode->i_num,offset>>12))) {
+			free_page(page);	/* read meanwhile by another */
+			if (!map_text(t,address))
+				break;
+		} else if (is_text(offset) && cache_text(page,offset>>12)) {
+			if (!map_page(page,address,5)) {
+				free_page(page);
+				break;
+			}
+		} else if (!put_page(page,address)) {
+			free_page(page);
+			break;
+		}
+		address += PAGE_SIZE;
+		offset += PAGE_SIZE;
+	}
+	for (j = 0 ; j < 4*n ; j++)
+		brelse(bh[j]);
+	return i;
+}
+
 void do_no_page(unsigned long error_code,unsigned long address)
 {
 	unsigned long tmp;
 
-	if (tmp=get_free_page())
+	address &= 0xfffff000;
+	tmp = address - get_base(current->ldt[1]);
+	if (current->executable && tmp < current->end_data) {
+		if (is_text(tmp) && share_text_page(address,tmp))
+			return;
+		if (read_exec_pages(address,tmp))
+			return;
+		do_exit(SIGSEGV);
+	}
+	if ((tmp=get_user_page(1)))
 		if (put_page(tmp,address))
 			return;
 	do_exit(SIGSEGV);
@@ -252,6 +726,24 @@ void calc_mem(void)
 	for(i=0 ; i<PAGING_PAGES ; i++)
 		if (!mem_map[i]) free++;
 	printk("%d pages free (of %d)\n\r",free,PAGING_PAGES);
+	printk("free blocks:");
+	for (i = 0 ; i < NR_ORDERS ; i++)
+		printk(" %d",page_stat.free_blocks[i]);
+	printk("\n\rallocated:");
+	for (i = 0 ; i < NR_ORDERS ; i++)
+		printk(" %d",page_stat.allocs[i]);
+	printk("\n\rfailed:");
+	for (i = 0 ; i < NR_ORDERS ; i++)
+		printk(" %d (%d fragmented)",page_stat.failed[i],
+			page_stat.fragmented[i]);
+	printk("\n\r%d splits, %d merges\n\r",page_stat.splits,
+		page_stat.merges);
+	printk("zero pool: %d pages, %d hits, %d misses, %d cleared\n\r",
+		nr_zero,page_stat.zero_hits,page_stat.zero_misses,
+		page_stat.zero_filled);
+	printk("text cache: %d pages, %d hits, %d misses, %d dropped\n\r",
+		nr_text,page_stat.text_hits,page_stat.text_misses,
+		page_stat.text_dropped);
 	for(i=2 ; i<1024 ; i++) {
 		if (1&pg_dir[i]) {
 			pg_tbl=(long *) (0xfffff000 & pg_dir[i]);
@@ -0,0 +1,114 @@
+/*
+ * iostat [interval [count]]: print what the block devices did in each
+ * 'interval' seconds (default 2), from the statistics the kernel keeps
+ * (see fs/block_dev.c). The first report is since boot.
+ *
+ * This runs on the system itself, not on the machine building it:
+ * compile it with the rest of the user programs.
+ */
+#define __LIBRARY__
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/iostat.h>
+
+#define HZ 100
+
+_syscall2(int,iostat,struct iostat *,buf,int,n)
+
+static struct iostat old[NR_IOSTAT], new[NR_IOSTAT];
+static int nr_old = 0;
+
+static void wake(int sig)
+{
+	signal(SIGALRM,wake);
+}
+
+static struct iostat * find_old(long dev)
+{
+	static struct iostat zero;
+	int i;
+
+	for (i = 0 ; i < nr_old ; i++)
+		if (old[i].dev == dev)
+			return old+i;
+	return &zero;
+}
+
+/* n/d with one decimal, as tenths */
+static long tenths(unsigned long n, unsigned long d)
+{
+	return d ? (10*n + d/2) / d : 0;
+}
+
+static void report(int nr, unsigned long ticks)
+{
+	struct iostat * n, * o;
+	unsigned long ios,dio[2],dsec[2],wait;
+	int i;
+	long t;
+
+	printf("dev    r/s    w/s  rkB/s  wkB/s rmrg/s wmrg/s seek/s "
+		"await  svc avgqu %%util inflt\n");
+	for (i = 0 ; i < nr ; i++) {
+		n = new+i;
+		o = find_old(n->dev);
+		dio[0] = n->ios[0] - o->ios[0];
+		dio[1] = n->ios[1] - o->ios[1];
+		dsec[0] = n->sectors[0] - o->sectors[0];
+		dsec[1] = n->sectors[1] - o->sectors[1];
+		ios = dio[0] + dio[1];
+		wait = n->queue_ticks[0] + n->queue_ticks[1] + n->svc_ticks[0] +
+			n->svc_ticks[1] - o->queue_ticks[0] - o->queue_ticks[1] -
+			o->svc_ticks[0] - o->svc_ticks[1];
+		printf("%04x %6ld %6ld %6ld %6ld %6ld %6ld %6ld",(int) n->dev,
+			tenths(dio[0]*HZ,ticks)/10,tenths(dio[1]*HZ,ticks)/10,
+			tenths(dsec[0]*HZ,2*ticks)/10,tenths(dsec[1]*HZ,2*ticks)/10,
+			tenths((n->merges[0]-o->merges[0])*HZ,ticks)/10,
+			tenths((n->merges[1]-o->merges[1])*HZ,ticks)/10,
+			tenths((n->seeks-o->seeks)*HZ,ticks)/10);
+		t = tenths(wait*(1000/HZ),ios);
+		printf(" %3ld.%ld",t/10,t%10);
+		t = tenths((n->busy_ticks-o->busy_ticks)*(1000/HZ),ios);
+		printf(" %2ld.%ld",t/10,t%10);
+		t = tenths(n->weighted_ticks-o->weighted_ticks,ticks);
+		printf(" %3ld.%ld",t/10,t%10);
+		printf(" %5ld %5ld\n",tenths(100*(n->busy_ticks-o->busy_ticks),
+			ticks)/10,n->in_flight);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	int interval = 2, count = -1, nr, i;
+	unsigned long ticks;
+
+	if (argc > 1 && (interval = atoi(argv[1])) <= 0) {
+		fprintf(stderr,"usage: iostat [interval [count]]\n");
+		exit(1);
+	}
+	if (argc > 2)
+		count = atoi(argv[2]);
+	signal(SIGALRM,wake);
+	while (count--) {
+		if ((nr = iostat(new,NR_IOSTAT)) < 0) {
+			perror("iostat");
+			exit(1);
+		}
+		ticks = 0;
+		for (i = 0 ; i < nr ; i++)
+			if (new[i].stamp - find_old(new[i].dev)->stamp > ticks)
+				ticks = new[i].stamp - find_old(new[i].dev)->stamp;
+		report(nr,ticks);
+		for (i = 0 ; i < nr ; i++)
+			old[i] = new[i];
+		nr_old = nr;
+		if (count) {
+			alarm(interval);
+			pause();
+			printf("\n");
+		}
+	}
+	exit(0);
+}